@@ -0,0 +1,4572 @@
+#define Audio_Sample_Rate 44100
+#define Audio_Format AUDIO_S16
+#define Audio_Bytes_Per_Sample (SDL_AUDIO_BITSIZE(Audio_Format)/8)
+#define Audio_Channels 2
+#define Audio_Frame_Size 1024
+#define Audio_BufLenInSamples(x) (x / (Audio_Bytes_Per_Sample))
+#define Audio_BufLenInSamplesPerChannel(x) (x / (Audio_Channels*Audio_Bytes_Per_Sample))
+#define Audio_BufLenInSeconds(x) (x / (r32)(Audio_Sample_Rate*Audio_Bytes_Per_Sample*Audio_Channels))
+#define Audio_SamplesInSeconds(x) (x / (r32)(Audio_Sample_Rate*Audio_Channels))
+#define Audio_Value_Max ((1<<(SDL_AUDIO_BITSIZE(Audio_Format)-1)) - 1)
+
+struct audio_Decoder;
+
+struct audio_Source
+{
+    s16 *buffer; // Pointer to original interleaved audio data
+                 // allocated when the source was loaded or made.
+    int length;  // Number of interleaved samples in buffer
+    int channels; // 1 for mono or 2 for stereo (LRLR...)
+    int loop_start; // Sample a repeating stream goes back to at the end
+    r32 loudness; // RMS level in range 0 to 1, used to rank voices
+
+    // Set for sources that are decoded while they play. The buffer
+    // is then the decoder's ring rather than the whole sound.
+    audio_Decoder *decoder;
+};
+
+// A second order IIR filter on a stream, in transposed direct
+// form II. The coefficients are normalized by a0, and each
+// channel of the mix keeps its own state.
+struct audio_Biquad
+{
+    r32 b0, b1, b2;
+    r32 a1, a2;
+    r32 z1[Audio_Channels];
+    r32 z2[Audio_Channels];
+};
+
+enum audio_FilterType
+{
+    Audio_Filter_None = 0,
+    Audio_Filter_Lowpass,
+    Audio_Filter_Highpass,
+    Audio_Filter_Bandpass,
+    Audio_Filter_Low_Shelf,
+    Audio_Filter_High_Shelf,
+    Audio_Filter_Peaking
+};
+
+// How a stream that plays at another rate reads between the
+// frames of its source (see audio_pitch).
+enum audio_Interpolation
+{
+    Audio_Linear = 0,
+    Audio_Cubic,
+    Audio_Sinc,
+    Audio_Interpolations
+};
+
+// A rate of 1 as a 32.32 step in source frames per output frame.
+#define Audio_Unit_Rate ((u64)1 << 32)
+#define Audio_Max_Rate 4
+
+struct audio_Stream
+{
+    audio_Source source;
+    int position; // Position in source buffer in samples
+    int remaining; // Number of samples remaining to be played
+    bool active;  // When true the stream is currently in use
+    bool paused;
+    bool repeat;
+    bool virtualized; // Not mixed in this callback, only advanced
+    int active_index; // Index in Audio.active_streams while playing, else -1
+    r32 gain_l; // Left channel gain in range 0 to 1
+    r32 gain_r; // Right channel gain in range 0 to 1
+
+    // Master times stream gain reached at the end of the last
+    // buffer. Each buffer ramps linearly from here to the new
+    // target, so gain changes don't step and cause zipper noise.
+    r32 mix_gain_l;
+    r32 mix_gain_r;
+    bool snap_gain; // Start the next buffer at the target gain
+
+    // Applied to the stream after its gain (see audio_filter)
+    bool filtered;
+    audio_Biquad biquad;
+
+    // Source frames per output frame, in 32.32. Together with
+    // _position_, _phase_ makes up the 32.32 position in frames.
+    u64 rate;
+    u32 phase;
+    audio_Interpolation interpolation;
+
+    // The fields above belong to the audio thread. The callback
+    // copies the position (in frames) and play state here after
+    // every buffer, so that the game thread can read them without
+    // locking. _published_generation_ is the generation of the
+    // last Open the audio thread applied; until it matches the one
+    // audio_stream handed out, the fields belong to whatever used
+    // the id before.
+    SDL_atomic_t published_position;
+    SDL_atomic_t published_playing;
+    SDL_atomic_t published_generation;
+};
+
+typedef int audio_id;
+
+enum audio_Flags
+{
+    Audio_NoFlag = 0,
+    Audio_Restart,
+    Audio_Repeat
+};
+
+enum audio_CmdType
+{
+    Audio_Cmd_Open = 0,
+    Audio_Cmd_Close,
+    Audio_Cmd_Play,
+    Audio_Cmd_Stop,
+    Audio_Cmd_Seek,
+    Audio_Cmd_Gain,
+    Audio_Cmd_Master_Gain,
+    Audio_Cmd_Voice_Budget,
+    Audio_Cmd_Filter,
+    Audio_Cmd_Pitch,
+    Audio_Cmd_Reverb_Send
+};
+
+struct audio_Cmd
+{
+    audio_CmdType type;
+    audio_id id;
+    audio_Source source; // Audio_Cmd_Open
+    int generation;
+    audio_Flags flags;   // Audio_Cmd_Play
+    int frame;           // Audio_Cmd_Seek
+    int max_real_voices; // Audio_Cmd_Voice_Budget
+    r32 gain_l;          // Audio_Cmd_Gain, Audio_Cmd_Master_Gain and Audio_Cmd_Reverb_Send
+    r32 gain_r;
+    audio_Biquad biquad; // Audio_Cmd_Filter, off if all zero
+    u64 rate;            // Audio_Cmd_Pitch
+    audio_Interpolation interpolation;
+};
+
+// Single-producer single-consumer ring of commands from the game
+// thread to the audio thread. Neither side ever waits for the
+// other: the game thread only writes _write_ and the audio thread
+// only writes _read_. Both count up forever and are masked when
+// indexing, so the queue is full when write - read == capacity.
+// The queue is drained once per callback, and is sized so that
+// every stream can be opened, played and given a gain within a
+// single game frame.
+#define Audio_Max_Cmds 16384
+struct audio_CmdQueue
+{
+    audio_Cmd cmds[Audio_Max_Cmds];
+    SDL_atomic_t write;
+    SDL_atomic_t read;
+};
+
+// A streamed Ogg Vorbis source. The decode thread keeps the ring
+// topped up, and the callback mixes straight out of it. Like the
+// command queue, _write_ and _read_ count samples up forever and
+// are masked when indexing; the decode thread only writes _write_
+// and the audio thread only writes _read_. The ring holds a whole
+// number of frames for both mono and stereo, so frames never wrap.
+#define Audio_Decoder_Ring_Samples (16384*Audio_Channels) // ~370 ms of stereo
+#define Audio_Max_Decoders 16
+#define Audio_Decode_Interval_Ms 10
+
+enum audio_DecoderState
+{
+    Audio_Decoder_Free = 0, // Can be claimed by audio_stream_ogg
+    Audio_Decoder_Claimed,  // Being opened by the game thread
+    Audio_Decoder_Open,
+    Audio_Decoder_Closing   // Stream closed, decode thread frees it
+};
+
+struct audio_Decoder
+{
+    stb_vorbis *vorbis;
+    int channels;
+    int length; // Length of the whole sound in samples, or 0 if unknown
+    s16 ring[Audio_Decoder_Ring_Samples];
+    SDL_atomic_t write;
+    SDL_atomic_t read;
+    u32 consumed; // Audio thread copy of _read_, published after mixing
+
+    SDL_atomic_t state;
+    SDL_atomic_t repeat;   // Set by the audio thread: loop at the end
+    SDL_atomic_t finished; // Set by the decode thread at the end
+
+    // Seeking. The audio thread sets _seek_frame_ and bumps
+    // _seek_request_; the decode thread seeks there, sets _seek_at_
+    // to the write position where the new samples begin and
+    // _seek_reached_ to the frame they start at, and then copies the
+    // request to _seek_done_. If the seek fails, as it does in a file
+    // of unknown length, decoding goes on from where it was and
+    // _seek_reached_ says so. Until Audio_Seek_Preroll_Samples have
+    // been written past _seek_at_ (or the sound ended), the callback
+    // keeps playing what was buffered before the seek, so it never
+    // waits on the decode thread.
+    SDL_atomic_t seek_frame;
+    SDL_atomic_t seek_request;
+    SDL_atomic_t seek_done;
+    SDL_atomic_t seek_at;
+    SDL_atomic_t seek_reached;
+    int seek_applied; // Audio thread: the last request it jumped to
+    u32 decoded_frame; // Decode thread: the frame it decodes next
+
+    // Memory stb_vorbis allocates everything from, reused by every
+    // stream this decoder plays (see audio_reserve_decoders). Null
+    // to use the heap.
+    char *arena;
+    bool in_arena; // The open stream fit, and decodes from the arena
+    char name[64]; // What is playing, to report the arena use
+};
+
+// Samples decoded after a seek before the callback switches over.
+#define Audio_Seek_Preroll_Samples (2048*Audio_Channels) // ~46 ms of stereo
+
+// Parsed headers of an Ogg Vorbis file or piece of memory, shared
+// by every decoder that plays it (see audio_vorbis_setup).
+struct audio_VorbisSetup
+{
+    stb_vorbis_setup *setup;
+    u08 *data; // Null for a file
+    int length;
+    char filename[256];
+    time_t mtime; // Of the file when its headers were parsed
+};
+
+#define Audio_Max_Vorbis_Setups 64
+
+// The most decoder arena a file has used in any of its streams.
+struct audio_ArenaUse
+{
+    char name[64];
+    int high_water;
+};
+
+#define Audio_Max_Arena_Uses 64
+
+#define Audio_Max_Streams 4096
+#define Audio_Default_Real_Voices 64
+struct Audio
+{
+    audio_Stream streams[Audio_Max_Streams];
+    int num_streams;
+    r32 gain_l;
+    r32 gain_r;
+    r32 reverb_send; // Share of the mix that goes through the reverb
+
+    // At most this many playing streams are mixed per callback.
+    // The rest are virtual: their position advances as if they
+    // were mixed, so they can become real again later.
+    int max_real_voices;
+    int num_real;
+
+    // Streams handed out by audio_stream and not yet closed,
+    // and a stack of the ids that are free. Only touched by
+    // the game thread.
+    bool open[Audio_Max_Streams];
+    int generation[Audio_Max_Streams]; // Bumped every time the id is handed out
+    audio_id free_ids[Audio_Max_Streams];
+    int num_free;
+
+    // Packed list of the streams that are playing, so that the
+    // callback only visits those. Only touched by the audio thread.
+    int active_streams[Audio_Max_Streams];
+    int num_active;
+
+    audio_CmdQueue cmds;
+
+    // Streamed sources, and the thread that decodes them. Started
+    // by the first call to audio_stream_ogg.
+    audio_Decoder decoders[Audio_Max_Decoders];
+    SDL_Thread *decode_thread;
+    int decoder_arena_bytes;
+
+    // Only touched by the game thread. Full slots are reused in turn.
+    audio_VorbisSetup vorbis_setups[Audio_Max_Vorbis_Setups];
+    int next_vorbis_setup;
+
+    // Only touched by the decode thread. Full slots are reused in turn.
+    audio_ArenaUse arena_uses[Audio_Max_Arena_Uses];
+    int next_arena_use;
+
+    // Set by audio_open. The callback writes whatever format the
+    // device was opened with, either AUDIO_S16SYS or AUDIO_F32SYS.
+    SDL_AudioDeviceID device;
+    SDL_AudioFormat device_format;
+} audio;
+
+typedef int audio_id;
+#define Audio_Invalid_Stream -1
+
+// Called from the game thread only.
+void audio_push(audio_Cmd cmd)
+{
+    audio_CmdQueue *queue = &audio.cmds;
+    u32 write = (u32)SDL_AtomicGet(&queue->write);
+    u32 read = (u32)SDL_AtomicGet(&queue->read);
+    SDL_MemoryBarrierAcquire();
+    if (write - read == Audio_Max_Cmds)
+    {
+        // The audio thread has not run for a long while
+        Printf("Audio command queue is full\n");
+        Assert(false);
+        return;
+    }
+    queue->cmds[write % Audio_Max_Cmds] = cmd;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&queue->write, (int)(write + 1));
+}
+
+// Returns a handle that can be used to refer
+// to the new stream in subsequence calls.
+// Returns -1 if the number of active streams
+// is maxed out. The handle is valid until
+// a call to audio_close with the given handle.
+// The stream is originally paused, and must
+// be started by a call to audio_play.
+audio_id audio_stream(audio_Source source)
+{
+    if (audio.num_free == 0)
+        return Audio_Invalid_Stream;
+
+    audio.num_free--;
+    audio_id id = audio.free_ids[audio.num_free];
+    audio.open[id] = 1;
+    audio.generation[id]++;
+    audio.num_streams++;
+
+    audio_Cmd cmd = {};
+    cmd.type = Audio_Cmd_Open;
+    cmd.id = id;
+    cmd.source = source;
+    cmd.generation = audio.generation[id];
+    audio_push(cmd);
+    return id;
+}
+
+void audio_close(audio_id id)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        audio.open[id] = 0;
+        audio.num_streams--;
+        audio.free_ids[audio.num_free] = id;
+        audio.num_free++;
+
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Close;
+        cmd.id = id;
+        audio_push(cmd);
+    }
+}
+
+void audio_play(audio_id id, audio_Flags flags = Audio_NoFlag)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Play;
+        cmd.id = id;
+        cmd.flags = flags;
+        audio_push(cmd);
+    }
+}
+
+void audio_stop(audio_id id)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Stop;
+        cmd.id = id;
+        audio_push(cmd);
+    }
+}
+
+// Moves the stream to the given frame (sample per channel), as
+// returned by audio_time, without changing whether it plays.
+// Streamed Ogg Vorbis jumps there once the decode thread has
+// caught up, a few tens of milliseconds later.
+void audio_seek(audio_id id, int frame)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Seek;
+        cmd.id = id;
+        cmd.frame = frame;
+        audio_push(cmd);
+    }
+}
+
+// True once the audio thread has opened the stream the game
+// thread handed out under this id, rather than a stream that
+// was closed and had its id reused.
+bool audio_opened(audio_id id)
+{
+    bool result = (id >= 0 && audio.open[id] &&
+                   SDL_AtomicGet(&audio.streams[id].published_generation) == audio.generation[id]);
+    SDL_MemoryBarrierAcquire();
+    return result;
+}
+
+// Returns the position along the stream for
+// one channel, in samples, as of the last
+// audio callback.
+int audio_time(audio_id id)
+{
+    int result = 0;
+    if (audio_opened(id))
+    {
+        result = SDL_AtomicGet(&audio.streams[id].published_position);
+    }
+    return result;
+}
+
+// Like audio_time, this reflects the state as of
+// the last audio callback; a stream that was just
+// passed to audio_play is not playing until then.
+bool audio_playing(audio_id id)
+{
+    return (audio_opened(id) &&
+            SDL_AtomicGet(&audio.streams[id].published_playing));
+}
+
+// Converts the result from a call to audio_time
+// to seconds.
+r32 audio_time_in_seconds(int samples_per_channel)
+{
+    return samples_per_channel / (r32)(Audio_Sample_Rate);
+}
+
+void audio_master_gain(r32 left, r32 right)
+{
+    audio_Cmd cmd = {};
+    cmd.type = Audio_Cmd_Master_Gain;
+    cmd.gain_l = left;
+    cmd.gain_r = right;
+    audio_push(cmd);
+}
+
+// Sets how much of the mix goes through the reverb, if one was
+// started with audio_start_reverb. 0, the default, sends nothing,
+// though what is already in the reverb still rings out.
+void audio_reverb_send(r32 send)
+{
+    audio_Cmd cmd = {};
+    cmd.type = Audio_Cmd_Reverb_Send;
+    cmd.gain_l = send;
+    audio_push(cmd);
+}
+
+// Sets how many of the playing streams are actually mixed;
+// the most audible ones (gain times source loudness) win.
+void audio_voice_budget(int max_real_voices)
+{
+    if (max_real_voices < 0)
+        max_real_voices = 0;
+    if (max_real_voices > Audio_Max_Streams)
+        max_real_voices = Audio_Max_Streams;
+
+    audio_Cmd cmd = {};
+    cmd.type = Audio_Cmd_Voice_Budget;
+    cmd.max_real_voices = max_real_voices;
+    audio_push(cmd);
+}
+
+void audio_gain(audio_id id, r32 left, r32 right)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Gain;
+        cmd.id = id;
+        cmd.gain_l = left;
+        cmd.gain_r = right;
+        audio_push(cmd);
+    }
+}
+
+// Sets the gains from an overall gain and a pan in range -1 (left)
+// to 1 (right), with a constant power law so that a mono source
+// keeps its loudness as it moves across. For a stereo source this
+// works as a balance control.
+void audio_pan(audio_id id, r32 gain, r32 pan)
+{
+    if (pan < -1.0f) pan = -1.0f;
+    else if (pan > 1.0f) pan = 1.0f;
+    r32 angle = (pan + 1.0f) * 0.25f * 3.14159265f;
+    audio_gain(id, gain*(r32)SDL_cos(angle), gain*(r32)SDL_sin(angle));
+}
+
+// Returns the coefficients of an RBJ cookbook filter. _q_ sets the
+// bandwidth of the band pass and peaking filters and the
+// resonance of the others, 0.7071 being flat; _gain_db_ is only
+// used by the shelves and the peaking filter.
+audio_Biquad audio_make_biquad(audio_FilterType type, r32 cutoff, r32 q, r32 gain_db)
+{
+    audio_Biquad result = {};
+    if (type == Audio_Filter_None)
+        return result;
+    if (cutoff < 10.0f) cutoff = 10.0f;
+    if (cutoff > 0.49f*Audio_Sample_Rate) cutoff = 0.49f*Audio_Sample_Rate;
+    if (q < 0.1f) q = 0.1f;
+
+    r32 w0 = 2.0f*3.14159265f*cutoff / Audio_Sample_Rate;
+    r32 cos_w0 = (r32)SDL_cos(w0);
+    r32 alpha = (r32)SDL_sin(w0) / (2.0f*q);
+    r32 A = (r32)SDL_pow(10.0, gain_db / 40.0);
+    r32 shelf = 2.0f*(r32)SDL_sqrt(A)*alpha;
+    r32 b0, b1, b2, a0, a1, a2;
+    switch (type)
+    {
+        case Audio_Filter_Lowpass:
+        {
+            b0 = 0.5f*(1.0f - cos_w0); b1 = 1.0f - cos_w0; b2 = b0;
+            a0 = 1.0f + alpha; a1 = -2.0f*cos_w0; a2 = 1.0f - alpha;
+        } break;
+
+        case Audio_Filter_Highpass:
+        {
+            b0 = 0.5f*(1.0f + cos_w0); b1 = -(1.0f + cos_w0); b2 = b0;
+            a0 = 1.0f + alpha; a1 = -2.0f*cos_w0; a2 = 1.0f - alpha;
+        } break;
+
+        case Audio_Filter_Bandpass:
+        {
+            // 0 dB at the center
+            b0 = alpha; b1 = 0.0f; b2 = -alpha;
+            a0 = 1.0f + alpha; a1 = -2.0f*cos_w0; a2 = 1.0f - alpha;
+        } break;
+
+        case Audio_Filter_Low_Shelf:
+        {
+            b0 = A*((A + 1.0f) - (A - 1.0f)*cos_w0 + shelf);
+            b1 = 2.0f*A*((A - 1.0f) - (A + 1.0f)*cos_w0);
+            b2 = A*((A + 1.0f) - (A - 1.0f)*cos_w0 - shelf);
+            a0 = (A + 1.0f) + (A - 1.0f)*cos_w0 + shelf;
+            a1 = -2.0f*((A - 1.0f) + (A + 1.0f)*cos_w0);
+            a2 = (A + 1.0f) + (A - 1.0f)*cos_w0 - shelf;
+        } break;
+
+        case Audio_Filter_High_Shelf:
+        {
+            b0 = A*((A + 1.0f) + (A - 1.0f)*cos_w0 + shelf);
+            b1 = -2.0f*A*((A - 1.0f) + (A + 1.0f)*cos_w0);
+            b2 = A*((A + 1.0f) + (A - 1.0f)*cos_w0 - shelf);
+            a0 = (A + 1.0f) - (A - 1.0f)*cos_w0 + shelf;
+            a1 = 2.0f*((A - 1.0f) - (A + 1.0f)*cos_w0);
+            a2 = (A + 1.0f) - (A - 1.0f)*cos_w0 - shelf;
+        } break;
+
+        default:
+        {
+            // Audio_Filter_Peaking
+            b0 = 1.0f + alpha*A; b1 = -2.0f*cos_w0; b2 = 1.0f - alpha*A;
+            a0 = 1.0f + alpha/A; a1 = -2.0f*cos_w0; a2 = 1.0f - alpha/A;
+        } break;
+    }
+    result.b0 = b0 / a0;
+    result.b1 = b1 / a0;
+    result.b2 = b2 / a0;
+    result.a1 = a1 / a0;
+    result.a2 = a2 / a0;
+    return result;
+}
+
+// Filters the stream, for occlusion, muffling it under water and
+// the like, or stops filtering it with Audio_Filter_None. The
+// filter changes at the start of the next buffer, so sweep the
+// cutoff in steps from frame to frame rather than jumping.
+void audio_filter(audio_id id, audio_FilterType type, r32 cutoff,
+                  r32 q = 0.7071f, r32 gain_db = 0.0f)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Filter;
+        cmd.id = id;
+        cmd.biquad = audio_make_biquad(type, cutoff, q, gain_db);
+        audio_push(cmd);
+    }
+}
+
+// Plays the stream _rate_ times as fast, which shifts its pitch
+// by the same ratio; 2 is an octave up. The rate is clamped to
+// 1/16 to Audio_Max_Rate. Streamed Ogg Vorbis always plays at 1.
+// Linear interpolation is the cheapest and dulls the highs, cubic
+// keeps more of them, and sinc is the cleanest. None of them
+// filter out what folds over when a sound is played faster.
+void audio_pitch(audio_id id, r32 rate, audio_Interpolation interpolation = Audio_Cubic)
+{
+    if (id >= 0 && audio.open[id])
+    {
+        if (rate < 1.0f/16.0f) rate = 1.0f/16.0f;
+        if (rate > Audio_Max_Rate) rate = Audio_Max_Rate;
+        audio_Cmd cmd = {};
+        cmd.type = Audio_Cmd_Pitch;
+        cmd.id = id;
+        cmd.rate = (u64)((double)rate*(double)Audio_Unit_Rate + 0.5);
+        cmd.interpolation = interpolation;
+        audio_push(cmd);
+    }
+}
+
+// Adds the stream to the list of playing streams.
+void audio_activate(audio_id id)
+{
+    audio_Stream *stream = audio.streams + id;
+    if (stream->active_index < 0)
+    {
+        stream->active_index = audio.num_active;
+        audio.active_streams[audio.num_active] = id;
+        audio.num_active++;
+    }
+    stream->paused = 0;
+}
+
+// Removes the stream from the list of playing streams by
+// moving the last playing stream into its place.
+void audio_deactivate(audio_id id)
+{
+    audio_Stream *stream = audio.streams + id;
+    stream->paused = 1;
+    if (stream->active_index >= 0)
+    {
+        int last = audio.active_streams[audio.num_active-1];
+        audio.active_streams[stream->active_index] = last;
+        audio.streams[last].active_index = stream->active_index;
+        audio.num_active--;
+        stream->active_index = -1;
+    }
+    SDL_AtomicSet(&stream->published_playing, 0);
+    SDL_AtomicSet(&stream->published_position, stream->position / stream->source.channels);
+}
+
+// Called from the audio thread only.
+void audio_seek_stream(audio_Stream *stream, int frame)
+{
+    int channels = stream->source.channels;
+    int length = stream->source.length;
+    if (frame < 0)
+        frame = 0;
+    if (length > 0 && frame > length / channels)
+        frame = length / channels;
+
+    // A decoder that is already there, like a stream that is
+    // restarted before it ever played, keeps what it has decoded.
+    audio_Decoder *decoder = stream->source.decoder;
+    bool in_place = (stream->position == frame*channels &&
+                  decoder && decoder->seek_applied == SDL_AtomicGet(&decoder->seek_request));
+    stream->position = frame*channels;
+    stream->remaining = length - stream->position;
+    stream->phase = 0;
+
+    if (decoder && !in_place)
+    {
+        SDL_AtomicSet(&decoder->seek_frame, frame);
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicAdd(&decoder->seek_request, 1);
+    }
+}
+
+// Applies all commands queued by the game thread
+// since the last callback. Called from the audio
+// thread only.
+void audio_process_cmds()
+{
+    audio_CmdQueue *queue = &audio.cmds;
+    u32 read = (u32)SDL_AtomicGet(&queue->read);
+    u32 write = (u32)SDL_AtomicGet(&queue->write);
+    SDL_MemoryBarrierAcquire();
+    for (; read != write; read++)
+    {
+        audio_Cmd cmd = queue->cmds[read % Audio_Max_Cmds];
+        audio_Stream *stream = audio.streams + cmd.id;
+        switch (cmd.type)
+        {
+            case Audio_Cmd_Open:
+            {
+                Assert(cmd.source.channels == 1 || cmd.source.channels == 2);
+                stream->source = cmd.source;
+                stream->position = 0;
+                stream->paused = 1;
+                stream->active = 1;
+                stream->active_index = -1;
+                stream->virtualized = 0;
+                stream->repeat = 0;
+                stream->gain_l = 1.0f;
+                stream->gain_r = 1.0f;
+                stream->remaining = cmd.source.length;
+                stream->filtered = 0;
+                stream->rate = Audio_Unit_Rate;
+                stream->phase = 0;
+                stream->interpolation = Audio_Cubic;
+                SDL_AtomicSet(&stream->published_position, 0);
+                SDL_AtomicSet(&stream->published_playing, 0);
+                SDL_MemoryBarrierRelease();
+                SDL_AtomicSet(&stream->published_generation, cmd.generation);
+            } break;
+
+            case Audio_Cmd_Close:
+            {
+                audio_deactivate(cmd.id);
+                stream->active = 0;
+                if (stream->source.decoder)
+                    SDL_AtomicSet(&stream->source.decoder->state, Audio_Decoder_Closing);
+            } break;
+
+            case Audio_Cmd_Play:
+            {
+                audio_Decoder *decoder = stream->source.decoder;
+                if (cmd.flags & Audio_Restart)
+                {
+                    audio_seek_stream(stream, 0);
+                }
+                if (cmd.flags & Audio_Repeat)
+                {
+                    stream->repeat = 1;
+                    if (decoder)
+                        SDL_AtomicSet(&decoder->repeat, 1);
+                }
+                // A stream that starts playing starts at full gain
+                // rather than fading in, to keep its attack.
+                if (stream->paused)
+                {
+                    stream->snap_gain = 1;
+                }
+                audio_activate(cmd.id);
+            } break;
+
+            case Audio_Cmd_Stop:
+            {
+                audio_deactivate(cmd.id);
+            } break;
+
+            case Audio_Cmd_Seek:
+            {
+                audio_seek_stream(stream, cmd.frame);
+            } break;
+
+            case Audio_Cmd_Gain:
+            {
+                stream->gain_l = cmd.gain_l;
+                stream->gain_r = cmd.gain_r;
+            } break;
+
+            case Audio_Cmd_Master_Gain:
+            {
+                audio.gain_l = cmd.gain_l;
+                audio.gain_r = cmd.gain_r;
+            } break;
+
+            case Audio_Cmd_Voice_Budget:
+            {
+                audio.max_real_voices = cmd.max_real_voices;
+            } break;
+
+            case Audio_Cmd_Reverb_Send:
+            {
+                audio.reverb_send = cmd.gain_l;
+            } break;
+
+            case Audio_Cmd_Filter:
+            {
+                // Keep the state of a filter that is only retuned
+                bool filtered = (cmd.biquad.b0 != 0.0f || cmd.biquad.b1 != 0.0f ||
+                                 cmd.biquad.b2 != 0.0f);
+                if (!stream->filtered)
+                    stream->biquad = cmd.biquad;
+                stream->biquad.b0 = cmd.biquad.b0;
+                stream->biquad.b1 = cmd.biquad.b1;
+                stream->biquad.b2 = cmd.biquad.b2;
+                stream->biquad.a1 = cmd.biquad.a1;
+                stream->biquad.a2 = cmd.biquad.a2;
+                stream->filtered = filtered;
+            } break;
+
+            case Audio_Cmd_Pitch:
+            {
+                if (!stream->source.decoder)
+                {
+                    stream->rate = cmd.rate;
+                    stream->interpolation = cmd.interpolation;
+                    if (cmd.rate == Audio_Unit_Rate)
+                        stream->phase = 0;
+                }
+            } break;
+        }
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&queue->read, (int)write);
+}
+
+s16 audio_r32_to_s16(r32 x)
+{
+    s32 result = (s32)(Audio_Value_Max*x);
+    if (result < -Audio_Value_Max) result = -Audio_Value_Max;
+    else if (result > Audio_Value_Max) result = Audio_Value_Max;
+    return (s16)(result);
+}
+
+r32 audio_s16_to_r32(s16 x)
+{
+    r32 result = (r32)(x) / (r32)Audio_Value_Max;
+    return result;
+}
+
+// Mixing kernels
+//
+// A kernel mixes _frames_ frames from _input_ into the interleaved
+// stereo mixing buffer _output_. Kernels are specialized on the
+// number of source channels: a stereo source is mixed LR to LR,
+// a mono source is spread to both channels, so panning it is just
+// a matter of the left and right gains. The gain of frame i is
+// gain + step*i for each channel, so that gain changes can be
+// ramped across a buffer instead of stepping at its start. The
+// scalar kernel is the reference; the SIMD kernels must produce
+// the same result up to rounding. audio_init picks the fastest
+// kernel the CPU supports.
+typedef void audio_MixFn(r32 *output, s16 *input, int frames,
+                         r32 gain_l, r32 gain_r,
+                         r32 step_l, r32 step_r);
+
+template <int Channels>
+void audio_mix_scalar(r32 *output, s16 *input, int frames,
+                      r32 gain_l, r32 gain_r,
+                      r32 step_l, r32 step_r)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        s16 l = input[Channels*i];
+        s16 r = input[Channels*i + Channels - 1];
+        output[2*i+0] += (gain_l + step_l*i) * audio_s16_to_r32(l);
+        output[2*i+1] += (gain_r + step_r*i) * audio_s16_to_r32(r);
+    }
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define AUDIO_NEON 1
+#include <arm_neon.h>
+#elif defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define AUDIO_SSE 1
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AUDIO_TARGET_SSE41
+#define AUDIO_TARGET_AVX2
+#else
+#define AUDIO_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define AUDIO_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// The SIMD kernels fold the s16 to r32 scale into the gains, and
+// compute the gain of each lane as gain + step*i from the frame
+// index rather than accumulating, so they don't drift from the
+// scalar kernel over long runs.
+#define AUDIO_MIX_TAIL() \
+    audio_mix_scalar<Channels>(output + 2*i, input + Channels*i, frames - i, \
+                               gain_l + step_l*i, gain_r + step_r*i, step_l, step_r)
+
+#ifdef AUDIO_SSE
+// Loads 4 frames as 8 x s16 in LRLR order. Mono samples are
+// duplicated into both channels.
+template <int Channels> __m128i audio_load4_sse2(s16 *input);
+
+template <> inline __m128i audio_load4_sse2<1>(s16 *input)
+{
+    __m128i x = _mm_loadl_epi64((__m128i*)input);
+    return _mm_unpacklo_epi16(x, x);
+}
+
+template <> inline __m128i audio_load4_sse2<2>(s16 *input)
+{
+    return _mm_loadu_si128((__m128i*)input);
+}
+
+// 8 frames per iteration: two 4 frame loads, widened to four
+// 4 x r32 vectors holding two LR pairs each.
+template <int Channels>
+void audio_mix_sse2(r32 *output, s16 *input, int frames,
+                    r32 gain_l, r32 gain_r,
+                    r32 step_l, r32 step_r)
+{
+    r32 scale = 1.0f / (r32)Audio_Value_Max;
+    __m128 step = _mm_setr_ps(scale*step_l, scale*step_r,
+                              scale*step_l, scale*step_r);
+    __m128 step2 = _mm_add_ps(step, step);
+    __m128 gain = _mm_setr_ps(scale*gain_l, scale*gain_r,
+                              scale*(gain_l + step_l), scale*(gain_r + step_r));
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i x0 = audio_load4_sse2<Channels>(input + Channels*i);
+        __m128i x1 = audio_load4_sse2<Channels>(input + Channels*(i + 4));
+
+        // sign extend by unpacking into the high half and shifting down
+        __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(x0, x0), 16);
+        __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(x0, x0), 16);
+        __m128i c = _mm_srai_epi32(_mm_unpacklo_epi16(x1, x1), 16);
+        __m128i d = _mm_srai_epi32(_mm_unpackhi_epi16(x1, x1), 16);
+
+        __m128 g0 = _mm_add_ps(gain, _mm_mul_ps(step, _mm_set1_ps((r32)i)));
+        __m128 g1 = _mm_add_ps(g0, step2);
+        __m128 g2 = _mm_add_ps(g1, step2);
+        __m128 g3 = _mm_add_ps(g2, step2);
+
+        r32 *out = output + 2*i;
+        _mm_storeu_ps(out + 0, _mm_add_ps(_mm_loadu_ps(out + 0), _mm_mul_ps(g0, _mm_cvtepi32_ps(a))));
+        _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(g1, _mm_cvtepi32_ps(b))));
+        _mm_storeu_ps(out + 8, _mm_add_ps(_mm_loadu_ps(out + 8), _mm_mul_ps(g2, _mm_cvtepi32_ps(c))));
+        _mm_storeu_ps(out + 12, _mm_add_ps(_mm_loadu_ps(out + 12), _mm_mul_ps(g3, _mm_cvtepi32_ps(d))));
+    }
+    AUDIO_MIX_TAIL();
+}
+
+template <int Channels>
+AUDIO_TARGET_SSE41
+void audio_mix_sse41(r32 *output, s16 *input, int frames,
+                     r32 gain_l, r32 gain_r,
+                     r32 step_l, r32 step_r)
+{
+    r32 scale = 1.0f / (r32)Audio_Value_Max;
+    __m128 step = _mm_setr_ps(scale*step_l, scale*step_r,
+                              scale*step_l, scale*step_r);
+    __m128 step2 = _mm_add_ps(step, step);
+    __m128 gain = _mm_setr_ps(scale*gain_l, scale*gain_r,
+                              scale*(gain_l + step_l), scale*(gain_r + step_r));
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i x0 = audio_load4_sse2<Channels>(input + Channels*i);
+        __m128i x1 = audio_load4_sse2<Channels>(input + Channels*(i + 4));
+
+        __m128i a = _mm_cvtepi16_epi32(x0);
+        __m128i b = _mm_cvtepi16_epi32(_mm_srli_si128(x0, 8));
+        __m128i c = _mm_cvtepi16_epi32(x1);
+        __m128i d = _mm_cvtepi16_epi32(_mm_srli_si128(x1, 8));
+
+        __m128 g0 = _mm_add_ps(gain, _mm_mul_ps(step, _mm_set1_ps((r32)i)));
+        __m128 g1 = _mm_add_ps(g0, step2);
+        __m128 g2 = _mm_add_ps(g1, step2);
+        __m128 g3 = _mm_add_ps(g2, step2);
+
+        r32 *out = output + 2*i;
+        _mm_storeu_ps(out + 0, _mm_add_ps(_mm_loadu_ps(out + 0), _mm_mul_ps(g0, _mm_cvtepi32_ps(a))));
+        _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_mul_ps(g1, _mm_cvtepi32_ps(b))));
+        _mm_storeu_ps(out + 8, _mm_add_ps(_mm_loadu_ps(out + 8), _mm_mul_ps(g2, _mm_cvtepi32_ps(c))));
+        _mm_storeu_ps(out + 12, _mm_add_ps(_mm_loadu_ps(out + 12), _mm_mul_ps(g3, _mm_cvtepi32_ps(d))));
+    }
+    AUDIO_MIX_TAIL();
+}
+
+// 16 frames per iteration.
+template <int Channels>
+AUDIO_TARGET_AVX2
+void audio_mix_avx2(r32 *output, s16 *input, int frames,
+                    r32 gain_l, r32 gain_r,
+                    r32 step_l, r32 step_r)
+{
+    r32 scale = 1.0f / (r32)Audio_Value_Max;
+    r32 gl = scale*gain_l;
+    r32 gr = scale*gain_r;
+    r32 sl = scale*step_l;
+    r32 sr = scale*step_r;
+    __m256 step = _mm256_setr_ps(sl, sr, sl, sr, sl, sr, sl, sr);
+    __m256 step4 = _mm256_mul_ps(step, _mm256_set1_ps(4.0f));
+    __m256 gain = _mm256_setr_ps(gl, gr, gl + sl, gr + sr,
+                                 gl + 2.0f*sl, gr + 2.0f*sr,
+                                 gl + 3.0f*sl, gr + 3.0f*sr);
+    int i = 0;
+    for (; i + 16 <= frames; i += 16)
+    {
+        __m256i a = _mm256_cvtepi16_epi32(audio_load4_sse2<Channels>(input + Channels*i));
+        __m256i b = _mm256_cvtepi16_epi32(audio_load4_sse2<Channels>(input + Channels*(i + 4)));
+        __m256i c = _mm256_cvtepi16_epi32(audio_load4_sse2<Channels>(input + Channels*(i + 8)));
+        __m256i d = _mm256_cvtepi16_epi32(audio_load4_sse2<Channels>(input + Channels*(i + 12)));
+
+        __m256 g0 = _mm256_add_ps(gain, _mm256_mul_ps(step, _mm256_set1_ps((r32)i)));
+        __m256 g1 = _mm256_add_ps(g0, step4);
+        __m256 g2 = _mm256_add_ps(g1, step4);
+        __m256 g3 = _mm256_add_ps(g2, step4);
+
+        r32 *out = output + 2*i;
+        _mm256_storeu_ps(out + 0, _mm256_add_ps(_mm256_loadu_ps(out + 0), _mm256_mul_ps(g0, _mm256_cvtepi32_ps(a))));
+        _mm256_storeu_ps(out + 8, _mm256_add_ps(_mm256_loadu_ps(out + 8), _mm256_mul_ps(g1, _mm256_cvtepi32_ps(b))));
+        _mm256_storeu_ps(out + 16, _mm256_add_ps(_mm256_loadu_ps(out + 16), _mm256_mul_ps(g2, _mm256_cvtepi32_ps(c))));
+        _mm256_storeu_ps(out + 24, _mm256_add_ps(_mm256_loadu_ps(out + 24), _mm256_mul_ps(g3, _mm256_cvtepi32_ps(d))));
+    }
+    AUDIO_MIX_TAIL();
+}
+
+// SDL 2.0.1 has no SDL_HasAVX2, so ask the CPU directly. The OS
+// must also have enabled saving the ymm registers (XCR0 bits 1-2).
+bool audio_has_avx2()
+{
+    #ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx)
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+    #else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+    #endif
+}
+#endif
+
+#ifdef AUDIO_NEON
+// Loads 4 frames as 8 x s16 in LRLR order, like audio_load4_sse2.
+template <int Channels> int16x8_t audio_load4_neon(s16 *input);
+
+template <> inline int16x8_t audio_load4_neon<1>(s16 *input)
+{
+    int16x4_t x = vld1_s16(input);
+    int16x4x2_t z = vzip_s16(x, x);
+    return vcombine_s16(z.val[0], z.val[1]);
+}
+
+template <> inline int16x8_t audio_load4_neon<2>(s16 *input)
+{
+    return vld1q_s16(input);
+}
+
+// 8 frames per iteration.
+template <int Channels>
+void audio_mix_neon(r32 *output, s16 *input, int frames,
+                    r32 gain_l, r32 gain_r,
+                    r32 step_l, r32 step_r)
+{
+    r32 scale = 1.0f / (r32)Audio_Value_Max;
+    r32 s[4] = { scale*step_l, scale*step_r, scale*step_l, scale*step_r };
+    r32 g[4] = { scale*gain_l, scale*gain_r,
+                 scale*(gain_l + step_l), scale*(gain_r + step_r) };
+    float32x4_t step = vld1q_f32(s);
+    float32x4_t step2 = vaddq_f32(step, step);
+    float32x4_t gain = vld1q_f32(g);
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        int16x8_t x0 = audio_load4_neon<Channels>(input + Channels*i);
+        int16x8_t x1 = audio_load4_neon<Channels>(input + Channels*(i + 4));
+
+        float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x0)));
+        float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x0)));
+        float32x4_t c = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x1)));
+        float32x4_t d = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x1)));
+
+        float32x4_t g0 = vmlaq_n_f32(gain, step, (r32)i);
+        float32x4_t g1 = vaddq_f32(g0, step2);
+        float32x4_t g2 = vaddq_f32(g1, step2);
+        float32x4_t g3 = vaddq_f32(g2, step2);
+
+        r32 *out = output + 2*i;
+        vst1q_f32(out + 0, vmlaq_f32(vld1q_f32(out + 0), g0, a));
+        vst1q_f32(out + 4, vmlaq_f32(vld1q_f32(out + 4), g1, b));
+        vst1q_f32(out + 8, vmlaq_f32(vld1q_f32(out + 8), g2, c));
+        vst1q_f32(out + 12, vmlaq_f32(vld1q_f32(out + 12), g3, d));
+    }
+    AUDIO_MIX_TAIL();
+}
+#endif
+
+// Fixed point mixing
+//
+// With AUDIO_FIXED_POINT set to 1 the callback accumulates into
+// s32 instead of r32, for machines with a weak FPU. Gains are
+// passed in Q30 so that a ramp can step by less than one Q15
+// unit per frame; frame i is scaled by the Q15 gain
+// (gain + step*i) >> 15 and the product shifted back down by 15.
+// Gains above 1 are clamped. The sum is saturated to s16 on
+// output. Every kernel is bit-exact with the scalar reference,
+// which audio_check_kernels verifies.
+#ifndef AUDIO_FIXED_POINT
+#define AUDIO_FIXED_POINT 0
+#endif
+
+typedef void audio_MixFixedFn(s32 *output, s16 *input, int frames,
+                              s32 gain_l, s32 gain_r,
+                              s32 step_l, s32 step_r);
+typedef void audio_PackFn(s16 *output, s32 *input, int samples);
+
+// The largest gain is 32767 in Q15, so that it still fits in
+// a signed 16-bit multiplier.
+s32 audio_gain_to_q30(r32 gain)
+{
+    s32 max = 32767 << 15;
+    if (gain <= 0.0f) return 0;
+    if (gain >= 1.0f) return max;
+    s32 result = (s32)(gain * (r32)(1 << 30));
+    return result < max ? result : max;
+}
+
+template <int Channels>
+void audio_mix_fixed_scalar(s32 *output, s16 *input, int frames,
+                            s32 gain_l, s32 gain_r,
+                            s32 step_l, s32 step_r)
+{
+    for (int i = 0; i < frames; i++)
+    {
+        s32 gl = (gain_l + step_l*i) >> 15;
+        s32 gr = (gain_r + step_r*i) >> 15;
+        output[2*i+0] += (input[Channels*i]*gl) >> 15;
+        output[2*i+1] += (input[Channels*i + Channels - 1]*gr) >> 15;
+    }
+}
+
+void audio_pack_scalar(s16 *output, s32 *input, int samples)
+{
+    for (int i = 0; i < samples; i++)
+    {
+        s32 x = input[i];
+        if (x < -32768) x = -32768;
+        else if (x > 32767) x = 32767;
+        output[i] = (s16)x;
+    }
+}
+
+#define AUDIO_MIX_FIXED_TAIL() \
+    audio_mix_fixed_scalar<Channels>(output + 2*i, input + Channels*i, frames - i, \
+                                     gain_l + step_l*i, gain_r + step_r*i, step_l, step_r)
+
+#ifdef AUDIO_SSE
+// 8 frames per iteration. Samples are unpacked next to a zero and
+// gains are below 2^15, so each pmaddwd lane is a single s16 x s16
+// product. Integer ramps don't drift, so the gains can be stepped.
+template <int Channels>
+void audio_mix_fixed_sse2(s32 *output, s16 *input, int frames,
+                          s32 gain_l, s32 gain_r,
+                          s32 step_l, s32 step_r)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i gain = _mm_setr_epi32(gain_l, gain_r, gain_l + step_l, gain_r + step_r);
+    __m128i step2 = _mm_setr_epi32(2*step_l, 2*step_r, 2*step_l, 2*step_r);
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        __m128i x0 = audio_load4_sse2<Channels>(input + Channels*i);
+        __m128i x1 = audio_load4_sse2<Channels>(input + Channels*(i + 4));
+
+        __m128i g0 = gain;
+        __m128i g1 = _mm_add_epi32(g0, step2);
+        __m128i g2 = _mm_add_epi32(g1, step2);
+        __m128i g3 = _mm_add_epi32(g2, step2);
+        gain = _mm_add_epi32(g3, step2);
+
+        __m128i a = _mm_madd_epi16(_mm_unpacklo_epi16(x0, zero), _mm_srai_epi32(g0, 15));
+        __m128i b = _mm_madd_epi16(_mm_unpackhi_epi16(x0, zero), _mm_srai_epi32(g1, 15));
+        __m128i c = _mm_madd_epi16(_mm_unpacklo_epi16(x1, zero), _mm_srai_epi32(g2, 15));
+        __m128i d = _mm_madd_epi16(_mm_unpackhi_epi16(x1, zero), _mm_srai_epi32(g3, 15));
+
+        __m128i *out = (__m128i*)(output + 2*i);
+        _mm_storeu_si128(out + 0, _mm_add_epi32(_mm_loadu_si128(out + 0), _mm_srai_epi32(a, 15)));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_srai_epi32(b, 15)));
+        _mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_srai_epi32(c, 15)));
+        _mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_srai_epi32(d, 15)));
+    }
+    AUDIO_MIX_FIXED_TAIL();
+}
+
+void audio_pack_sse2(s16 *output, s32 *input, int samples)
+{
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128i a = _mm_loadu_si128((__m128i*)(input + i));
+        __m128i b = _mm_loadu_si128((__m128i*)(input + i + 4));
+        _mm_storeu_si128((__m128i*)(output + i), _mm_packs_epi32(a, b));
+    }
+    audio_pack_scalar(output + i, input + i, samples - i);
+}
+#endif
+
+#ifdef AUDIO_NEON
+template <int Channels>
+void audio_mix_fixed_neon(s32 *output, s16 *input, int frames,
+                          s32 gain_l, s32 gain_r,
+                          s32 step_l, s32 step_r)
+{
+    s32 g[4] = { gain_l, gain_r, gain_l + step_l, gain_r + step_r };
+    s32 s[4] = { 2*step_l, 2*step_r, 2*step_l, 2*step_r };
+    int32x4_t gain = vld1q_s32(g);
+    int32x4_t step2 = vld1q_s32(s);
+    int i = 0;
+    for (; i + 8 <= frames; i += 8)
+    {
+        int16x8_t x0 = audio_load4_neon<Channels>(input + Channels*i);
+        int16x8_t x1 = audio_load4_neon<Channels>(input + Channels*(i + 4));
+
+        int32x4_t g0 = gain;
+        int32x4_t g1 = vaddq_s32(g0, step2);
+        int32x4_t g2 = vaddq_s32(g1, step2);
+        int32x4_t g3 = vaddq_s32(g2, step2);
+        gain = vaddq_s32(g3, step2);
+
+        int32x4_t a = vmull_s16(vget_low_s16(x0), vmovn_s32(vshrq_n_s32(g0, 15)));
+        int32x4_t b = vmull_s16(vget_high_s16(x0), vmovn_s32(vshrq_n_s32(g1, 15)));
+        int32x4_t c = vmull_s16(vget_low_s16(x1), vmovn_s32(vshrq_n_s32(g2, 15)));
+        int32x4_t d = vmull_s16(vget_high_s16(x1), vmovn_s32(vshrq_n_s32(g3, 15)));
+
+        s32 *out = output + 2*i;
+        vst1q_s32(out + 0, vsraq_n_s32(vld1q_s32(out + 0), a, 15));
+        vst1q_s32(out + 4, vsraq_n_s32(vld1q_s32(out + 4), b, 15));
+        vst1q_s32(out + 8, vsraq_n_s32(vld1q_s32(out + 8), c, 15));
+        vst1q_s32(out + 12, vsraq_n_s32(vld1q_s32(out + 12), d, 15));
+    }
+    AUDIO_MIX_FIXED_TAIL();
+}
+
+void audio_pack_neon(s16 *output, s32 *input, int samples)
+{
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        int16x4_t a = vqmovn_s32(vld1q_s32(input + i));
+        int16x4_t b = vqmovn_s32(vld1q_s32(input + i + 4));
+        vst1q_s16(output + i, vcombine_s16(a, b));
+    }
+    audio_pack_scalar(output + i, input + i, samples - i);
+}
+#endif
+
+// Output conversion
+//
+// Converts the r32 mix to s16 the same way as audio_r32_to_s16:
+// scale, truncate towards zero and clamp to +-Audio_Value_Max.
+// The SIMD kernels clamp before truncating, which gives the same
+// result because the limits are whole numbers.
+typedef void audio_ConvertFn(s16 *output, r32 *input, int samples);
+
+void audio_convert_scalar(s16 *output, r32 *input, int samples)
+{
+    for (int i = 0; i < samples; i++)
+        output[i] = audio_r32_to_s16(input[i]);
+}
+
+#ifdef AUDIO_SSE
+void audio_convert_sse2(s16 *output, r32 *input, int samples)
+{
+    __m128 scale = _mm_set1_ps((r32)Audio_Value_Max);
+    __m128 lo = _mm_set1_ps(-(r32)Audio_Value_Max);
+    __m128 hi = _mm_set1_ps((r32)Audio_Value_Max);
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        __m128 a = _mm_mul_ps(scale, _mm_loadu_ps(input + i));
+        __m128 b = _mm_mul_ps(scale, _mm_loadu_ps(input + i + 4));
+        a = _mm_min_ps(_mm_max_ps(a, lo), hi);
+        b = _mm_min_ps(_mm_max_ps(b, lo), hi);
+        __m128i x = _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+        _mm_storeu_si128((__m128i*)(output + i), x);
+    }
+    audio_convert_scalar(output + i, input + i, samples - i);
+}
+#endif
+
+#ifdef AUDIO_NEON
+void audio_convert_neon(s16 *output, r32 *input, int samples)
+{
+    float32x4_t lo = vdupq_n_f32(-(r32)Audio_Value_Max);
+    float32x4_t hi = vdupq_n_f32((r32)Audio_Value_Max);
+    int i = 0;
+    for (; i + 8 <= samples; i += 8)
+    {
+        float32x4_t a = vmulq_n_f32(vld1q_f32(input + i), (r32)Audio_Value_Max);
+        float32x4_t b = vmulq_n_f32(vld1q_f32(input + i + 4), (r32)Audio_Value_Max);
+        a = vminq_f32(vmaxq_f32(a, lo), hi);
+        b = vminq_f32(vmaxq_f32(b, lo), hi);
+        int16x4_t x0 = vmovn_s32(vcvtq_s32_f32(a));
+        int16x4_t x1 = vmovn_s32(vcvtq_s32_f32(b));
+        vst1q_s16(output + i, vcombine_s16(x0, x1));
+    }
+    audio_convert_scalar(output + i, input + i, samples - i);
+}
+#endif
+
+// Filter kernels
+//
+// Filtered streams are mixed into buffers of their own, and then
+// filtered Audio_Filter_Group at a time: the kernel runs the
+// biquads of every channel of the group side by side, one frame
+// at a time, and adds the results into _output_. Unused slots of
+// a group have all zero coefficients and silent input. The state
+// is flushed to zero once it is inaudible, so a filter that rings
+// out never runs on denormals for longer than a buffer.
+#define Audio_Filter_Group 4
+
+typedef void audio_FilterFn(r32 *output, r32 **inputs, audio_Biquad **biquads, int frames);
+
+inline r32 audio_flush_denormal(r32 x)
+{
+    return (x > -1e-15f && x < 1e-15f) ? 0.0f : x;
+}
+
+void audio_flush_biquads(audio_Biquad **biquads)
+{
+    for (int v = 0; v < Audio_Filter_Group; v++)
+    {
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            biquads[v]->z1[c] = audio_flush_denormal(biquads[v]->z1[c]);
+            biquads[v]->z2[c] = audio_flush_denormal(biquads[v]->z2[c]);
+        }
+    }
+}
+
+void audio_filter_scalar(r32 *output, r32 **inputs, audio_Biquad **biquads, int frames)
+{
+    for (int v = 0; v < Audio_Filter_Group; v++)
+    {
+        audio_Biquad *f = biquads[v];
+        r32 *input = inputs[v];
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            r32 z1 = f->z1[c];
+            r32 z2 = f->z2[c];
+            for (int i = 0; i < frames; i++)
+            {
+                r32 x = input[2*i + c];
+                r32 y = f->b0*x + z1;
+                z1 = f->b1*x - f->a1*y + z2;
+                z2 = f->b2*x - f->a2*y;
+                output[2*i + c] += y;
+            }
+            f->z1[c] = z1;
+            f->z2[c] = z2;
+        }
+    }
+    audio_flush_biquads(biquads);
+}
+
+#ifdef AUDIO_SSE
+// Two voices per vector, as LRLR: voices 0 and 1 in _a_, 2 and 3
+// in _b_.
+#define AUDIO_BIQUAD_LANES(f, field) \
+    _mm_setr_ps(f[0]->field, f[0]->field, f[1]->field, f[1]->field), \
+    _mm_setr_ps(f[2]->field, f[2]->field, f[3]->field, f[3]->field)
+
+void audio_filter_sse2(r32 *output, r32 **inputs, audio_Biquad **f, int frames)
+{
+    __m128 b0[2] = { AUDIO_BIQUAD_LANES(f, b0) };
+    __m128 b1[2] = { AUDIO_BIQUAD_LANES(f, b1) };
+    __m128 b2[2] = { AUDIO_BIQUAD_LANES(f, b2) };
+    __m128 a1[2] = { AUDIO_BIQUAD_LANES(f, a1) };
+    __m128 a2[2] = { AUDIO_BIQUAD_LANES(f, a2) };
+    __m128 z1[2];
+    __m128 z2[2];
+    for (int h = 0; h < 2; h++)
+    {
+        z1[h] = _mm_setr_ps(f[2*h]->z1[0], f[2*h]->z1[1], f[2*h+1]->z1[0], f[2*h+1]->z1[1]);
+        z2[h] = _mm_setr_ps(f[2*h]->z2[0], f[2*h]->z2[1], f[2*h+1]->z2[0], f[2*h+1]->z2[1]);
+    }
+    __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < frames; i++)
+    {
+        __m128 sum = zero;
+        for (int h = 0; h < 2; h++)
+        {
+            __m128 x = _mm_loadl_pi(zero, (__m64*)(inputs[2*h] + 2*i));
+            x = _mm_loadh_pi(x, (__m64*)(inputs[2*h+1] + 2*i));
+            __m128 y = _mm_add_ps(_mm_mul_ps(b0[h], x), z1[h]);
+            z1[h] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1[h], x), _mm_mul_ps(a1[h], y)), z2[h]);
+            z2[h] = _mm_sub_ps(_mm_mul_ps(b2[h], x), _mm_mul_ps(a2[h], y));
+            sum = _mm_add_ps(sum, y);
+        }
+        // Fold the LR pairs of the voices into one
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        __m128 mix = _mm_loadl_pi(zero, (__m64*)(output + 2*i));
+        _mm_storel_pi((__m64*)(output + 2*i), _mm_add_ps(mix, sum));
+    }
+    for (int h = 0; h < 2; h++)
+    {
+        r32 state[8];
+        _mm_storeu_ps(state, z1[h]);
+        _mm_storeu_ps(state + 4, z2[h]);
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            f[2*h]->z1[c] = state[c];
+            f[2*h+1]->z1[c] = state[2 + c];
+            f[2*h]->z2[c] = state[4 + c];
+            f[2*h+1]->z2[c] = state[6 + c];
+        }
+    }
+    audio_flush_biquads(f);
+}
+#undef AUDIO_BIQUAD_LANES
+
+// All four voices in one vector, as LRLRLRLR.
+AUDIO_TARGET_AVX2
+void audio_filter_avx2(r32 *output, r32 **inputs, audio_Biquad **f, int frames)
+{
+    #define AUDIO_BIQUAD_LANES(field) \
+        _mm256_setr_ps(f[0]->field, f[0]->field, f[1]->field, f[1]->field, \
+                       f[2]->field, f[2]->field, f[3]->field, f[3]->field)
+    __m256 b0 = AUDIO_BIQUAD_LANES(b0);
+    __m256 b1 = AUDIO_BIQUAD_LANES(b1);
+    __m256 b2 = AUDIO_BIQUAD_LANES(b2);
+    __m256 a1 = AUDIO_BIQUAD_LANES(a1);
+    __m256 a2 = AUDIO_BIQUAD_LANES(a2);
+    #undef AUDIO_BIQUAD_LANES
+    __m256 z1 = _mm256_setr_ps(f[0]->z1[0], f[0]->z1[1], f[1]->z1[0], f[1]->z1[1],
+                               f[2]->z1[0], f[2]->z1[1], f[3]->z1[0], f[3]->z1[1]);
+    __m256 z2 = _mm256_setr_ps(f[0]->z2[0], f[0]->z2[1], f[1]->z2[0], f[1]->z2[1],
+                               f[2]->z2[0], f[2]->z2[1], f[3]->z2[0], f[3]->z2[1]);
+    __m128 zero = _mm_setzero_ps();
+    for (int i = 0; i < frames; i++)
+    {
+        __m128 lo = _mm_loadh_pi(_mm_loadl_pi(zero, (__m64*)(inputs[0] + 2*i)),
+                                 (__m64*)(inputs[1] + 2*i));
+        __m128 hi = _mm_loadh_pi(_mm_loadl_pi(zero, (__m64*)(inputs[2] + 2*i)),
+                                 (__m64*)(inputs[3] + 2*i));
+        __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+        __m256 y = _mm256_add_ps(_mm256_mul_ps(b0, x), z1);
+        z1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(b1, x), _mm256_mul_ps(a1, y)), z2);
+        z2 = _mm256_sub_ps(_mm256_mul_ps(b2, x), _mm256_mul_ps(a2, y));
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(y), _mm256_extractf128_ps(y, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        __m128 mix = _mm_loadl_pi(zero, (__m64*)(output + 2*i));
+        _mm_storel_pi((__m64*)(output + 2*i), _mm_add_ps(mix, sum));
+    }
+    r32 state[16];
+    _mm256_storeu_ps(state, z1);
+    _mm256_storeu_ps(state + 8, z2);
+    for (int v = 0; v < Audio_Filter_Group; v++)
+    {
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            f[v]->z1[c] = state[2*v + c];
+            f[v]->z2[c] = state[8 + 2*v + c];
+        }
+    }
+    audio_flush_biquads(f);
+}
+#endif
+
+#ifdef AUDIO_NEON
+void audio_filter_neon(r32 *output, r32 **inputs, audio_Biquad **f, int frames)
+{
+    float32x4_t b0[2], b1[2], b2[2], a1[2], a2[2], z1[2], z2[2];
+    for (int h = 0; h < 2; h++)
+    {
+        audio_Biquad *p = f[2*h];
+        audio_Biquad *q = f[2*h+1];
+        r32 lanes[7][4] = {
+            { p->b0, p->b0, q->b0, q->b0 },
+            { p->b1, p->b1, q->b1, q->b1 },
+            { p->b2, p->b2, q->b2, q->b2 },
+            { p->a1, p->a1, q->a1, q->a1 },
+            { p->a2, p->a2, q->a2, q->a2 },
+            { p->z1[0], p->z1[1], q->z1[0], q->z1[1] },
+            { p->z2[0], p->z2[1], q->z2[0], q->z2[1] },
+        };
+        b0[h] = vld1q_f32(lanes[0]);
+        b1[h] = vld1q_f32(lanes[1]);
+        b2[h] = vld1q_f32(lanes[2]);
+        a1[h] = vld1q_f32(lanes[3]);
+        a2[h] = vld1q_f32(lanes[4]);
+        z1[h] = vld1q_f32(lanes[5]);
+        z2[h] = vld1q_f32(lanes[6]);
+    }
+    for (int i = 0; i < frames; i++)
+    {
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int h = 0; h < 2; h++)
+        {
+            float32x4_t x = vcombine_f32(vld1_f32(inputs[2*h] + 2*i), vld1_f32(inputs[2*h+1] + 2*i));
+            float32x4_t y = vaddq_f32(vmulq_f32(b0[h], x), z1[h]);
+            z1[h] = vaddq_f32(vsubq_f32(vmulq_f32(b1[h], x), vmulq_f32(a1[h], y)), z2[h]);
+            z2[h] = vsubq_f32(vmulq_f32(b2[h], x), vmulq_f32(a2[h], y));
+            sum = vaddq_f32(sum, y);
+        }
+        float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+        vst1_f32(output + 2*i, vadd_f32(vld1_f32(output + 2*i), pair));
+    }
+    for (int h = 0; h < 2; h++)
+    {
+        r32 state[8];
+        vst1q_f32(state, z1[h]);
+        vst1q_f32(state + 4, z2[h]);
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            f[2*h]->z1[c] = state[c];
+            f[2*h+1]->z1[c] = state[2 + c];
+            f[2*h]->z2[c] = state[4 + c];
+            f[2*h+1]->z2[c] = state[6 + c];
+        }
+    }
+    audio_flush_biquads(f);
+}
+#endif
+
+// Pitch kernels
+//
+// A stream that plays at another rate is first copied into a
+// stereo r32 buffer, with silence or the start of the loop past
+// its ends, so that the kernels never check bounds. A kernel mixes
+// _frames_ frames into _output_ with the same gain ramp as the
+// mixing kernels. Output frame i reads around source frame
+// (position + step*i) >> 32 of _input_, which must be readable
+// from Audio_Sinc_Taps/2 - 1 frames before to Audio_Sinc_Taps/2
+// frames after it. The SIMD kernels hold the LR pairs of two
+// neighbouring source frames in a vector, and must match the
+// scalar ones up to rounding.
+#define Audio_Sinc_Taps 8
+#define Audio_Sinc_Phase_Bits 8
+#define Audio_Sinc_Phases (1 << Audio_Sinc_Phase_Bits)
+
+typedef void audio_PitchFn(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                           r32 gain_l, r32 gain_r,
+                           r32 step_l, r32 step_r);
+
+// Windowed sinc coefficients for Audio_Sinc_Phases + 1 evenly
+// spaced fractions from 0 to 1, each for taps -3 to 4 around the
+// frame. Every coefficient is stored twice, once for each channel,
+// to line up with the LRLR input. Filled in by audio_init.
+r32 audio_sinc_table[Audio_Sinc_Phases + 1][Audio_Sinc_Taps*Audio_Channels];
+
+void audio_init_sinc_table()
+{
+    double pi = 3.14159265358979323846;
+    for (int p = 0; p <= Audio_Sinc_Phases; p++)
+    {
+        double t = p / (double)Audio_Sinc_Phases;
+        double taps[Audio_Sinc_Taps];
+        double sum = 0.0;
+        for (int k = 0; k < Audio_Sinc_Taps; k++)
+        {
+            // Blackman window over the taps, zero at +-Taps/2
+            double x = (k - (Audio_Sinc_Taps/2 - 1)) - t;
+            double sinc = x == 0.0 ? 1.0 : SDL_sin(pi*x) / (pi*x);
+            double w = 2.0*pi*x / Audio_Sinc_Taps;
+            double window = 0.42 + 0.5*SDL_cos(w) + 0.08*SDL_cos(2.0*w);
+            taps[k] = sinc*window;
+            sum += taps[k];
+        }
+        // Unity gain at DC for every fraction
+        for (int k = 0; k < Audio_Sinc_Taps; k++)
+        {
+            audio_sinc_table[p][2*k + 0] = (r32)(taps[k] / sum);
+            audio_sinc_table[p][2*k + 1] = (r32)(taps[k] / sum);
+        }
+    }
+}
+
+// The fraction of a 32.32 position, from 0 up to but not
+// including 1. Only the top 24 bits are used, which an r32 holds
+// exactly; all 32 would round the largest phases up to 1.
+inline r32 audio_fraction(u64 position)
+{
+    return (r32)((u32)position >> 8) * (1.0f / 16777216.0f);
+}
+
+// Splits the fraction of a 32.32 position into the row of the
+// sinc table below it, from its top bits, and the fraction of the
+// way to the next row, from the 24 bits under those.
+inline int audio_sinc_row(u64 position, r32 *fraction)
+{
+    #define AUDIO_SINC_ROW_SHIFT (32 - Audio_Sinc_Phase_Bits)
+    u32 phase = (u32)position;
+    u32 below = phase & ((1u << AUDIO_SINC_ROW_SHIFT) - 1);
+    *fraction = (r32)below * (1.0f / (r32)(1u << AUDIO_SINC_ROW_SHIFT));
+    return (int)(phase >> AUDIO_SINC_ROW_SHIFT);
+    #undef AUDIO_SINC_ROW_SHIFT
+}
+
+// Catmull-Rom weights of frames -1 to 2 around the frame
+inline void audio_cubic_weights(r32 t, r32 *w)
+{
+    r32 t2 = t*t;
+    r32 t3 = t2*t;
+    w[0] = 0.5f*(-t + 2.0f*t2 - t3);
+    w[1] = 0.5f*(2.0f - 5.0f*t2 + 3.0f*t3);
+    w[2] = 0.5f*(t + 4.0f*t2 - 3.0f*t3);
+    w[3] = 0.5f*(-t2 + t3);
+}
+
+void audio_mix_linear_scalar(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                             r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32);
+        r32 t = audio_fraction(position);
+        r32 l = x[0] + t*(x[2] - x[0]);
+        r32 r = x[1] + t*(x[3] - x[1]);
+        output[2*i+0] += (gain_l + step_l*i) * l;
+        output[2*i+1] += (gain_r + step_r*i) * r;
+    }
+}
+
+void audio_mix_cubic_scalar(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                            r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32) - 2;
+        r32 w[4];
+        audio_cubic_weights(audio_fraction(position), w);
+        r32 l = w[0]*x[0] + w[1]*x[2] + w[2]*x[4] + w[3]*x[6];
+        r32 r = w[0]*x[1] + w[1]*x[3] + w[2]*x[5] + w[3]*x[7];
+        output[2*i+0] += (gain_l + step_l*i) * l;
+        output[2*i+1] += (gain_r + step_r*i) * r;
+    }
+}
+
+// Between two rows of the table, the coefficients are
+// interpolated linearly.
+void audio_mix_sinc_scalar(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                           r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32) - 2*(Audio_Sinc_Taps/2 - 1);
+        r32 t;
+        int row = audio_sinc_row(position, &t);
+        r32 *c0 = audio_sinc_table[row];
+        r32 *c1 = audio_sinc_table[row + 1];
+        r32 l = 0.0f;
+        r32 r = 0.0f;
+        for (int k = 0; k < Audio_Sinc_Taps; k++)
+        {
+            l += (c0[2*k] + t*(c1[2*k] - c0[2*k])) * x[2*k];
+            r += (c0[2*k+1] + t*(c1[2*k+1] - c0[2*k+1])) * x[2*k+1];
+        }
+        output[2*i+0] += (gain_l + step_l*i) * l;
+        output[2*i+1] += (gain_r + step_r*i) * r;
+    }
+}
+
+#ifdef AUDIO_SSE
+// Adds the LR pair of a frame, held as two pairs to be summed, to
+// the output with the gain of frame i.
+#define AUDIO_PITCH_MIX_SSE2(sum) \
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum)); \
+    __m128 gain = _mm_add_ps(gain0, _mm_mul_ps(steps, _mm_set1_ps((r32)i))); \
+    __m128 mix = _mm_loadl_pi(_mm_setzero_ps(), (__m64*)(output + 2*i)); \
+    _mm_storel_pi((__m64*)(output + 2*i), _mm_add_ps(mix, _mm_mul_ps(gain, sum)));
+
+void audio_mix_linear_sse2(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                           r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    __m128 gain0 = _mm_setr_ps(gain_l, gain_r, 0.0f, 0.0f);
+    __m128 steps = _mm_setr_ps(step_l, step_r, 0.0f, 0.0f);
+    // LR of the frame and the next, weighted 1 - t and t
+    __m128 w0 = _mm_setr_ps(1.0f, 1.0f, 0.0f, 0.0f);
+    __m128 w1 = _mm_setr_ps(-1.0f, -1.0f, 1.0f, 1.0f);
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        __m128 x = _mm_loadu_ps(input + 2*(position >> 32));
+        __m128 t = _mm_set1_ps(audio_fraction(position));
+        __m128 sum = _mm_mul_ps(_mm_add_ps(w0, _mm_mul_ps(w1, t)), x);
+        AUDIO_PITCH_MIX_SSE2(sum)
+    }
+}
+
+void audio_mix_cubic_sse2(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                          r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    __m128 gain0 = _mm_setr_ps(gain_l, gain_r, 0.0f, 0.0f);
+    __m128 steps = _mm_setr_ps(step_l, step_r, 0.0f, 0.0f);
+    // The weights of audio_cubic_weights as polynomials in t, for
+    // the LR pairs of frames -1, 0 and 1, 2
+    __m128 a0 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 1.0f);
+    __m128 a1 = _mm_setr_ps(-0.5f, -0.5f, 0.0f, 0.0f);
+    __m128 a2 = _mm_setr_ps(1.0f, 1.0f, -2.5f, -2.5f);
+    __m128 a3 = _mm_setr_ps(-0.5f, -0.5f, 1.5f, 1.5f);
+    __m128 b1 = _mm_setr_ps(0.5f, 0.5f, 0.0f, 0.0f);
+    __m128 b2 = _mm_setr_ps(2.0f, 2.0f, -0.5f, -0.5f);
+    __m128 b3 = _mm_setr_ps(-1.5f, -1.5f, 0.5f, 0.5f);
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32) - 2;
+        __m128 t = _mm_set1_ps(audio_fraction(position));
+        __m128 wa = _mm_add_ps(a0, _mm_mul_ps(t, _mm_add_ps(a1, _mm_mul_ps(t, _mm_add_ps(a2, _mm_mul_ps(t, a3))))));
+        __m128 wb = _mm_mul_ps(t, _mm_add_ps(b1, _mm_mul_ps(t, _mm_add_ps(b2, _mm_mul_ps(t, b3)))));
+        __m128 sum = _mm_add_ps(_mm_mul_ps(wa, _mm_loadu_ps(x)),
+                                _mm_mul_ps(wb, _mm_loadu_ps(x + 4)));
+        AUDIO_PITCH_MIX_SSE2(sum)
+    }
+}
+
+void audio_mix_sinc_sse2(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                         r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    __m128 gain0 = _mm_setr_ps(gain_l, gain_r, 0.0f, 0.0f);
+    __m128 steps = _mm_setr_ps(step_l, step_r, 0.0f, 0.0f);
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32) - 2*(Audio_Sinc_Taps/2 - 1);
+        r32 t;
+        int row = audio_sinc_row(position, &t);
+        __m128 f = _mm_set1_ps(t);
+        r32 *c0 = audio_sinc_table[row];
+        r32 *c1 = audio_sinc_table[row + 1];
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < 2*Audio_Sinc_Taps; k += 4)
+        {
+            __m128 a = _mm_loadu_ps(c0 + k);
+            __m128 c = _mm_add_ps(a, _mm_mul_ps(f, _mm_sub_ps(_mm_loadu_ps(c1 + k), a)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(c, _mm_loadu_ps(x + k)));
+        }
+        AUDIO_PITCH_MIX_SSE2(sum)
+    }
+}
+#undef AUDIO_PITCH_MIX_SSE2
+#endif
+
+#ifdef AUDIO_NEON
+#define AUDIO_PITCH_MIX_NEON(sum) \
+    float32x2_t pair = vadd_f32(vget_low_f32(sum), vget_high_f32(sum)); \
+    float32x2_t gain = vadd_f32(gain0, vmul_n_f32(steps, (r32)i)); \
+    vst1_f32(output + 2*i, vadd_f32(vld1_f32(output + 2*i), vmul_f32(gain, pair)));
+
+void audio_mix_linear_neon(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                           r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    r32 g[2] = { gain_l, gain_r };
+    r32 s[2] = { step_l, step_r };
+    float32x2_t gain0 = vld1_f32(g);
+    float32x2_t steps = vld1_f32(s);
+    float32x4_t w0 = vcombine_f32(vdup_n_f32(1.0f), vdup_n_f32(0.0f));
+    float32x4_t w1 = vcombine_f32(vdup_n_f32(-1.0f), vdup_n_f32(1.0f));
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        float32x4_t x = vld1q_f32(input + 2*(position >> 32));
+        float32x4_t sum = vmulq_f32(vmlaq_n_f32(w0, w1, audio_fraction(position)), x);
+        AUDIO_PITCH_MIX_NEON(sum)
+    }
+}
+
+void audio_mix_cubic_neon(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                          r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    r32 g[2] = { gain_l, gain_r };
+    r32 s[2] = { step_l, step_r };
+    float32x2_t gain0 = vld1_f32(g);
+    float32x2_t steps = vld1_f32(s);
+    float32x4_t a0 = vcombine_f32(vdup_n_f32(0.0f), vdup_n_f32(1.0f));
+    float32x4_t a1 = vcombine_f32(vdup_n_f32(-0.5f), vdup_n_f32(0.0f));
+    float32x4_t a2 = vcombine_f32(vdup_n_f32(1.0f), vdup_n_f32(-2.5f));
+    float32x4_t a3 = vcombine_f32(vdup_n_f32(-0.5f), vdup_n_f32(1.5f));
+    float32x4_t b1 = vcombine_f32(vdup_n_f32(0.5f), vdup_n_f32(0.0f));
+    float32x4_t b2 = vcombine_f32(vdup_n_f32(2.0f), vdup_n_f32(-0.5f));
+    float32x4_t b3 = vcombine_f32(vdup_n_f32(-1.5f), vdup_n_f32(0.5f));
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32) - 2;
+        r32 t = audio_fraction(position);
+        float32x4_t wa = vmlaq_n_f32(a0, vmlaq_n_f32(a1, vmlaq_n_f32(a2, a3, t), t), t);
+        float32x4_t wb = vmulq_n_f32(vmlaq_n_f32(b1, vmlaq_n_f32(b2, b3, t), t), t);
+        float32x4_t sum = vaddq_f32(vmulq_f32(wa, vld1q_f32(x)), vmulq_f32(wb, vld1q_f32(x + 4)));
+        AUDIO_PITCH_MIX_NEON(sum)
+    }
+}
+
+void audio_mix_sinc_neon(r32 *output, r32 *input, u64 position, u64 step, int frames,
+                         r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    r32 g[2] = { gain_l, gain_r };
+    r32 s[2] = { step_l, step_r };
+    float32x2_t gain0 = vld1_f32(g);
+    float32x2_t steps = vld1_f32(s);
+    for (int i = 0; i < frames; i++, position += step)
+    {
+        r32 *x = input + 2*(position >> 32) - 2*(Audio_Sinc_Taps/2 - 1);
+        r32 t;
+        int row = audio_sinc_row(position, &t);
+        float32x4_t f = vdupq_n_f32(t);
+        r32 *c0 = audio_sinc_table[row];
+        r32 *c1 = audio_sinc_table[row + 1];
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int k = 0; k < 2*Audio_Sinc_Taps; k += 4)
+        {
+            float32x4_t a = vld1q_f32(c0 + k);
+            float32x4_t c = vaddq_f32(a, vmulq_f32(f, vsubq_f32(vld1q_f32(c1 + k), a)));
+            sum = vaddq_f32(sum, vmulq_f32(c, vld1q_f32(x + k)));
+        }
+        AUDIO_PITCH_MIX_NEON(sum)
+    }
+}
+#undef AUDIO_PITCH_MIX_NEON
+#endif
+
+// Convolution kernel
+//
+// Adds the product of two spectra to _acc_, bin by bin, for the
+// reverb (see audio_start_reverb). Nearly all of its time goes
+// here. The spectra are split into real and imaginary parts so
+// that the vector loops are plain elementwise complex products.
+typedef void audio_ConvolveFn(r32 *acc_re, r32 *acc_im,
+                              r32 *x_re, r32 *x_im,
+                              r32 *h_re, r32 *h_im, int bins);
+
+void audio_convolve_scalar(r32 *acc_re, r32 *acc_im,
+                           r32 *x_re, r32 *x_im,
+                           r32 *h_re, r32 *h_im, int bins)
+{
+    for (int k = 0; k < bins; k++)
+    {
+        acc_re[k] += x_re[k]*h_re[k] - x_im[k]*h_im[k];
+        acc_im[k] += x_re[k]*h_im[k] + x_im[k]*h_re[k];
+    }
+}
+
+#ifdef AUDIO_SSE
+void audio_convolve_sse2(r32 *acc_re, r32 *acc_im,
+                         r32 *x_re, r32 *x_im,
+                         r32 *h_re, r32 *h_im, int bins)
+{
+    int k = 0;
+    for (; k + 4 <= bins; k += 4)
+    {
+        __m128 xr = _mm_loadu_ps(x_re + k);
+        __m128 xi = _mm_loadu_ps(x_im + k);
+        __m128 hr = _mm_loadu_ps(h_re + k);
+        __m128 hi = _mm_loadu_ps(h_im + k);
+        __m128 re = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+        __m128 im = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+        _mm_storeu_ps(acc_re + k, _mm_add_ps(_mm_loadu_ps(acc_re + k), re));
+        _mm_storeu_ps(acc_im + k, _mm_add_ps(_mm_loadu_ps(acc_im + k), im));
+    }
+    audio_convolve_scalar(acc_re + k, acc_im + k, x_re + k, x_im + k, h_re + k, h_im + k, bins - k);
+}
+
+AUDIO_TARGET_AVX2
+void audio_convolve_avx2(r32 *acc_re, r32 *acc_im,
+                         r32 *x_re, r32 *x_im,
+                         r32 *h_re, r32 *h_im, int bins)
+{
+    int k = 0;
+    for (; k + 8 <= bins; k += 8)
+    {
+        __m256 xr = _mm256_loadu_ps(x_re + k);
+        __m256 xi = _mm256_loadu_ps(x_im + k);
+        __m256 hr = _mm256_loadu_ps(h_re + k);
+        __m256 hi = _mm256_loadu_ps(h_im + k);
+        __m256 re = _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi));
+        __m256 im = _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr));
+        _mm256_storeu_ps(acc_re + k, _mm256_add_ps(_mm256_loadu_ps(acc_re + k), re));
+        _mm256_storeu_ps(acc_im + k, _mm256_add_ps(_mm256_loadu_ps(acc_im + k), im));
+    }
+    audio_convolve_scalar(acc_re + k, acc_im + k, x_re + k, x_im + k, h_re + k, h_im + k, bins - k);
+}
+#endif
+
+#ifdef AUDIO_NEON
+void audio_convolve_neon(r32 *acc_re, r32 *acc_im,
+                         r32 *x_re, r32 *x_im,
+                         r32 *h_re, r32 *h_im, int bins)
+{
+    int k = 0;
+    for (; k + 4 <= bins; k += 4)
+    {
+        float32x4_t xr = vld1q_f32(x_re + k);
+        float32x4_t xi = vld1q_f32(x_im + k);
+        float32x4_t hr = vld1q_f32(h_re + k);
+        float32x4_t hi = vld1q_f32(h_im + k);
+        float32x4_t re = vmlsq_f32(vmlaq_f32(vld1q_f32(acc_re + k), xr, hr), xi, hi);
+        float32x4_t im = vmlaq_f32(vmlaq_f32(vld1q_f32(acc_im + k), xr, hi), xi, hr);
+        vst1q_f32(acc_re + k, re);
+        vst1q_f32(acc_im + k, im);
+    }
+    audio_convolve_scalar(acc_re + k, acc_im + k, x_re + k, x_im + k, h_re + k, h_im + k, bins - k);
+}
+#endif
+
+// The mixing kernels are indexed by the number of source
+// channels minus one.
+audio_MixFn *audio_mix[Audio_Channels] = { audio_mix_scalar<1>, audio_mix_scalar<2> };
+audio_ConvertFn *audio_convert = audio_convert_scalar;
+audio_MixFixedFn *audio_mix_fixed[Audio_Channels] = { audio_mix_fixed_scalar<1>, audio_mix_fixed_scalar<2> };
+audio_PackFn *audio_pack = audio_pack_scalar;
+audio_FilterFn *audio_filter_kernel = audio_filter_scalar;
+audio_ConvolveFn *audio_convolve = audio_convolve_scalar;
+audio_PitchFn *audio_mix_pitch[Audio_Interpolations] = {
+    audio_mix_linear_scalar, audio_mix_cubic_scalar, audio_mix_sinc_scalar
+};
+
+// Define as 1 to check the kernels at startup. Off by default,
+// so that a rounding difference on the player's machine can't
+// stop the game on an assert.
+#ifndef AUDIO_CHECK_KERNELS
+#define AUDIO_CHECK_KERNELS 0
+#endif
+
+// Runs the selected kernels against the scalar references on a
+// noise buffer with a gain ramp. The fixed point kernels must
+// match exactly, the float kernels up to rounding.
+void audio_check_kernels()
+{
+    #define CHECK_FRAMES 203
+    static s16 input[CHECK_FRAMES*2];
+    static r32 expect_r32[CHECK_FRAMES*2];
+    static r32 result_r32[CHECK_FRAMES*2];
+    static s32 expect_s32[CHECK_FRAMES*2];
+    static s32 result_s32[CHECK_FRAMES*2];
+    static s16 expect_s16[CHECK_FRAMES*2];
+    static s16 result_s16[CHECK_FRAMES*2];
+    u32 seed = 12345;
+    for (int i = 0; i < CHECK_FRAMES*2; i++)
+    {
+        seed = seed*1664525 + 1013904223;
+        input[i] = (s16)(seed >> 16);
+    }
+
+    s32 gain_l = audio_gain_to_q30(0.9f);
+    s32 gain_r = audio_gain_to_q30(0.1f);
+    s32 step = audio_gain_to_q30(0.004f);
+    for (int channels = 1; channels <= Audio_Channels; channels++)
+    {
+        audio_MixFn *mix_scalar = channels == 1 ? audio_mix_scalar<1> : audio_mix_scalar<2>;
+        audio_MixFixedFn *mix_fixed_scalar = (channels == 1 ?
+                                              audio_mix_fixed_scalar<1> :
+                                              audio_mix_fixed_scalar<2>);
+        for (int i = 0; i < CHECK_FRAMES*2; i++)
+        {
+            expect_r32[i] = result_r32[i] = 0.25f;
+            expect_s32[i] = result_s32[i] = (s32)(input[i]*16);
+        }
+
+        mix_scalar(expect_r32, input, CHECK_FRAMES, 0.9f, 0.1f, -0.004f, 0.004f);
+        audio_mix[channels-1](result_r32, input, CHECK_FRAMES, 0.9f, 0.1f, -0.004f, 0.004f);
+        for (int i = 0; i < CHECK_FRAMES*2; i++)
+        {
+            r32 error = expect_r32[i] - result_r32[i];
+            Assert(error > -1e-5f && error < 1e-5f);
+        }
+
+        mix_fixed_scalar(expect_s32, input, CHECK_FRAMES, gain_l, gain_r, -step, step);
+        audio_mix_fixed[channels-1](result_s32, input, CHECK_FRAMES, gain_l, gain_r, -step, step);
+        Assert(SDL_memcmp(expect_s32, result_s32, sizeof(expect_s32)) == 0);
+    }
+
+    audio_pack_scalar(expect_s16, expect_s32, CHECK_FRAMES*2);
+    audio_pack(result_s16, expect_s32, CHECK_FRAMES*2);
+    Assert(SDL_memcmp(expect_s16, result_s16, sizeof(expect_s16)) == 0);
+
+    // include some samples that clip
+    for (int i = 0; i < CHECK_FRAMES*2; i++)
+        expect_r32[i] *= 4.0f;
+    audio_convert_scalar(expect_s16, expect_r32, CHECK_FRAMES*2);
+    audio_convert(result_s16, expect_r32, CHECK_FRAMES*2);
+    Assert(SDL_memcmp(expect_s16, result_s16, sizeof(expect_s16)) == 0);
+
+    // A resonant low pass, a shelf that boosts, and two empty
+    // slots, from the same state
+    audio_Biquad expect_biquads[Audio_Filter_Group] = {
+        audio_make_biquad(Audio_Filter_Lowpass, 800.0f, 4.0f, 0.0f),
+        audio_make_biquad(Audio_Filter_High_Shelf, 3000.0f, 0.7071f, 12.0f),
+    };
+    for (int v = 0; v < Audio_Filter_Group; v++)
+    {
+        expect_biquads[v].z1[0] = expect_biquads[v].z1[1] = 0.01f*v;
+        expect_biquads[v].z2[0] = expect_biquads[v].z2[1] = -0.01f*v;
+    }
+    audio_Biquad result_biquads[Audio_Filter_Group];
+    SDL_memcpy(result_biquads, expect_biquads, sizeof(result_biquads));
+    r32 *filter_inputs[Audio_Filter_Group];
+    audio_Biquad *expect_filters[Audio_Filter_Group];
+    audio_Biquad *result_filters[Audio_Filter_Group];
+    for (int v = 0; v < Audio_Filter_Group; v++)
+    {
+        filter_inputs[v] = v < 2 ? expect_r32 : result_r32;
+        expect_filters[v] = expect_biquads + v;
+        result_filters[v] = result_biquads + v;
+    }
+    SDL_memset(result_r32, 0, sizeof(result_r32));
+    static r32 expect_filtered[CHECK_FRAMES*2];
+    static r32 result_filtered[CHECK_FRAMES*2];
+    audio_filter_scalar(expect_filtered, filter_inputs, expect_filters, CHECK_FRAMES);
+    audio_filter_kernel(result_filtered, filter_inputs, result_filters, CHECK_FRAMES);
+    for (int i = 0; i < CHECK_FRAMES*2; i++)
+    {
+        r32 error = expect_filtered[i] - result_filtered[i];
+        Assert(error > -1e-4f && error < 1e-4f);
+    }
+
+    // Noise read at 1.37 times the rate, from a fraction of the
+    // way into a frame
+    r32 *pitch_input = expect_filtered + 2*(Audio_Sinc_Taps/2 - 1);
+    int pitch_frames = (CHECK_FRAMES - Audio_Sinc_Taps) * 100 / 137;
+    u64 pitch_step = (u64)(1.37*(double)Audio_Unit_Rate);
+    for (int kind = 0; kind < Audio_Interpolations; kind++)
+    {
+        audio_PitchFn *scalar = (kind == Audio_Linear ? audio_mix_linear_scalar :
+                                 kind == Audio_Cubic ? audio_mix_cubic_scalar :
+                                 audio_mix_sinc_scalar);
+        SDL_memset(expect_r32, 0, sizeof(expect_r32));
+        SDL_memset(result_r32, 0, sizeof(result_r32));
+        scalar(expect_r32, pitch_input, 0x40000000u, pitch_step, pitch_frames, 0.9f, 0.1f, -0.004f, 0.004f);
+        audio_mix_pitch[kind](result_r32, pitch_input, 0x40000000u, pitch_step, pitch_frames, 0.9f, 0.1f, -0.004f, 0.004f);
+        for (int i = 0; i < CHECK_FRAMES*2; i++)
+        {
+            r32 error = expect_r32[i] - result_r32[i];
+            Assert(error > -1e-5f && error < 1e-5f);
+        }
+    }
+
+    // Spectra of noise, with an odd number of bins for the tails
+    static r32 expect_acc[CHECK_FRAMES*2];
+    static r32 result_acc[CHECK_FRAMES*2];
+    for (int i = 0; i < CHECK_FRAMES*2; i++)
+        expect_acc[i] = result_acc[i] = input[i] / 32768.0f;
+    audio_convolve_scalar(expect_acc, expect_acc + CHECK_FRAMES,
+                          expect_filtered, expect_filtered + CHECK_FRAMES,
+                          result_filtered, result_filtered + CHECK_FRAMES, CHECK_FRAMES);
+    audio_convolve(result_acc, result_acc + CHECK_FRAMES,
+                   expect_filtered, expect_filtered + CHECK_FRAMES,
+                   result_filtered, result_filtered + CHECK_FRAMES, CHECK_FRAMES);
+    for (int i = 0; i < CHECK_FRAMES*2; i++)
+    {
+        r32 error = expect_acc[i] - result_acc[i];
+        Assert(error > -1e-5f && error < 1e-5f);
+    }
+
+    // well below one step of the s16 output
+    Assert(stb_vorbis_check_simd() < 1e-6f);
+    #undef CHECK_FRAMES
+}
+
+// Selects the mixing kernels for this CPU. Must be called before
+// any sources are loaded and before the audio device is opened.
+void audio_init()
+{
+    const char *kernel = "scalar";
+    int vorbis_simd = STB_VORBIS_SIMD_NONE;
+    #ifdef AUDIO_SSE
+    if (SDL_HasSSE2())
+    {
+        vorbis_simd = STB_VORBIS_SIMD_SSE2;
+        audio_mix[0] = audio_mix_sse2<1>;
+        audio_mix[1] = audio_mix_sse2<2>;
+        audio_convert = audio_convert_sse2;
+        audio_mix_fixed[0] = audio_mix_fixed_sse2<1>;
+        audio_mix_fixed[1] = audio_mix_fixed_sse2<2>;
+        audio_pack = audio_pack_sse2;
+        audio_filter_kernel = audio_filter_sse2;
+        audio_mix_pitch[Audio_Linear] = audio_mix_linear_sse2;
+        audio_mix_pitch[Audio_Cubic] = audio_mix_cubic_sse2;
+        audio_mix_pitch[Audio_Sinc] = audio_mix_sinc_sse2;
+        audio_convolve = audio_convolve_sse2;
+        kernel = "sse2";
+    }
+    if (SDL_HasSSE41())
+    {
+        audio_mix[0] = audio_mix_sse41<1>;
+        audio_mix[1] = audio_mix_sse41<2>;
+        kernel = "sse4.1";
+    }
+    if (audio_has_avx2())
+    {
+        vorbis_simd = STB_VORBIS_SIMD_AVX2;
+        audio_mix[0] = audio_mix_avx2<1>;
+        audio_mix[1] = audio_mix_avx2<2>;
+        audio_filter_kernel = audio_filter_avx2;
+        audio_convolve = audio_convolve_avx2;
+        kernel = "avx2";
+    }
+    #endif
+    #ifdef AUDIO_NEON
+    vorbis_simd = STB_VORBIS_SIMD_NEON;
+    audio_mix[0] = audio_mix_neon<1>;
+    audio_mix[1] = audio_mix_neon<2>;
+    audio_convert = audio_convert_neon;
+    audio_mix_fixed[0] = audio_mix_fixed_neon<1>;
+    audio_mix_fixed[1] = audio_mix_fixed_neon<2>;
+    audio_pack = audio_pack_neon;
+    audio_filter_kernel = audio_filter_neon;
+    audio_mix_pitch[Audio_Linear] = audio_mix_linear_neon;
+    audio_mix_pitch[Audio_Cubic] = audio_mix_cubic_neon;
+    audio_mix_pitch[Audio_Sinc] = audio_mix_sinc_neon;
+    audio_convolve = audio_convolve_neon;
+    kernel = "neon";
+    #endif
+    // Decoding uses the same instruction set as mixing
+    stb_vorbis_set_simd(vorbis_simd);
+
+    #if AUDIO_FIXED_POINT
+    Printf("Mixing kernel: %s (fixed point)\n", kernel);
+    #else
+    Printf("Mixing kernel: %s\n", kernel);
+    #endif
+
+    audio_init_sinc_table();
+
+    #if AUDIO_CHECK_KERNELS
+    audio_check_kernels();
+    #endif
+
+    audio.device = 0;
+    audio.device_format = AUDIO_S16SYS;
+    audio.num_streams = 0;
+    audio.num_active = 0;
+    audio.max_real_voices = Audio_Default_Real_Voices;
+    audio.num_free = 0;
+    for (int id = Audio_Max_Streams-1; id >= 0; id--)
+    {
+        audio.open[id] = 0;
+        audio.generation[id] = 0;
+        SDL_AtomicSet(&audio.streams[id].published_generation, 0);
+        audio.streams[id].active = 0;
+        audio.streams[id].active_index = -1;
+        audio.free_ids[audio.num_free] = id;
+        audio.num_free++;
+    }
+}
+
+// Loading
+//
+// Sources are always stored in the mixer format: s16 at
+// Audio_Sample_Rate, mono or stereo. audio_load converts anything
+// else once when the file is loaded, so the callback never does.
+
+// Root mean square of the samples, scaled to 0 to 1.
+r32 audio_measure_loudness(s16 *buffer, int length)
+{
+    if (length <= 0)
+        return 0.0f;
+    double sum = 0.0;
+    for (int i = 0; i < length; i++)
+        sum += (double)buffer[i]*(double)buffer[i];
+    return (r32)(SDL_sqrt(sum / length) / Audio_Value_Max);
+}
+
+// The input data must
+//  - be sampled at Audio_Sample_Rate
+//  - be mono, or have Audio_Channels interleaved channel samples (LRLRLR...)
+// The returned struct does not make a copy of the data, so the
+// user must ensure that it is preserved and freed properly.
+audio_Source make_source(s16 *data, u32 total_num_samples, int channels = Audio_Channels)
+{
+    Assert(channels == 1 || channels == 2);
+    audio_Source result = {};
+    result.buffer = data;
+    result.length = total_num_samples;
+    result.channels = channels;
+    result.loudness = audio_measure_loudness(data, total_num_samples);
+    return result;
+}
+
+// SDL has no format for packed 24-bit samples, so we make one up
+// with the same layout: signed flag and bit size.
+#define Audio_Format_S24LSB (SDL_AUDIO_MASK_SIGNED | 24)
+
+u32 audio_read_u16(u08 *p) { return p[0] | (p[1] << 8); }
+u32 audio_read_u32(u08 *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24); }
+
+// Finds the fmt and data chunks of a WAV file in memory. On
+// success _data_ points into _file_. Understands 8, 16, 24 and
+// 32-bit PCM and 32-bit float, including WAVE_FORMAT_EXTENSIBLE
+// headers.
+bool audio_parse_riff(u08 *file, s32 size, SDL_AudioSpec *spec,
+                      u08 **data, u32 *data_size)
+{
+    if (size < 12 ||
+        SDL_memcmp(file, "RIFF", 4) != 0 ||
+        SDL_memcmp(file + 8, "WAVE", 4) != 0)
+        return false;
+
+    u32 tag = 0;
+    u32 channels = 0;
+    u32 freq = 0;
+    u32 bits = 0;
+    *data = 0;
+    *data_size = 0;
+    s32 at = 12;
+    while (at + 8 <= size)
+    {
+        u08 *chunk = file + at;
+        u32 chunk_size = audio_read_u32(chunk + 4);
+        if (chunk_size > (u32)(size - at - 8))
+            chunk_size = (u32)(size - at - 8);
+        if (SDL_memcmp(chunk, "fmt ", 4) == 0 && chunk_size >= 16)
+        {
+            tag = audio_read_u16(chunk + 8);
+            channels = audio_read_u16(chunk + 10);
+            freq = audio_read_u32(chunk + 12);
+            bits = audio_read_u16(chunk + 22);
+            // WAVE_FORMAT_EXTENSIBLE keeps the real tag in the
+            // first two bytes of the sub-format GUID.
+            if (tag == 0xFFFE && chunk_size >= 40)
+                tag = audio_read_u16(chunk + 32);
+        }
+        else if (SDL_memcmp(chunk, "data", 4) == 0)
+        {
+            *data = chunk + 8;
+            *data_size = chunk_size;
+        }
+        at += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    SDL_AudioFormat format = 0;
+    if (tag == 1 && bits == 8)       format = AUDIO_U8;
+    else if (tag == 1 && bits == 16) format = AUDIO_S16LSB;
+    else if (tag == 1 && bits == 24) format = Audio_Format_S24LSB;
+    else if (tag == 1 && bits == 32) format = AUDIO_S32LSB;
+    else if (tag == 3 && bits == 32) format = AUDIO_F32LSB;
+    if (format == 0 || *data == 0 || channels == 0 || freq == 0)
+        return false;
+
+    SDL_zerop(spec);
+    spec->freq = freq;
+    spec->format = format;
+    spec->channels = (u08)channels;
+    return true;
+}
+
+// Fallback for the WAV files that SDL_LoadWAV rejects: 24-bit PCM
+// and WAVE_FORMAT_EXTENSIBLE headers. Returns the same things as
+// SDL_LoadWAV, and the buffer should likewise be freed with
+// SDL_FreeWAV.
+bool audio_load_riff(char *filename, SDL_AudioSpec *spec,
+                     u08 **buffer, u32 *length_in_bytes)
+{
+    SDL_RWops *rw = SDL_RWFromFile(filename, "rb");
+    if (!rw)
+        return false;
+    s32 size = (s32)SDL_RWsize(rw);
+    u08 *file = (u08*)SDL_malloc(size > 0 ? size : 1);
+    bool ok = size > 12 && SDL_RWread(rw, file, size, 1) == 1;
+    SDL_RWclose(rw);
+
+    u08 *data = 0;
+    u32 data_size = 0;
+    ok = ok && audio_parse_riff(file, size, spec, &data, &data_size);
+    if (ok)
+    {
+        *buffer = (u08*)SDL_malloc(data_size > 0 ? data_size : 1);
+        SDL_memcpy(*buffer, data, data_size);
+        *length_in_bytes = data_size;
+    }
+    SDL_free(file);
+    return ok;
+}
+
+// Converts samples in any of the integer or float formats that
+// audio_load accepts to r32 in range -1 to 1.
+void audio_decode_to_r32(r32 *output, u08 *input, int samples, SDL_AudioFormat format)
+{
+    if (format == AUDIO_S16SYS)
+    {
+        s16 *in = (s16*)input;
+        for (int i = 0; i < samples; i++)
+            output[i] = audio_s16_to_r32(in[i]);
+        return;
+    }
+    if (format == AUDIO_F32SYS)
+    {
+        SDL_memcpy(output, input, samples*sizeof(r32));
+        return;
+    }
+
+    // Generic path: assemble each sample as an unsigned integer,
+    // flip the sign bit of unsigned formats and sign extend from
+    // the top of an s32.
+    int bits = SDL_AUDIO_BITSIZE(format);
+    int bytes = bits / 8;
+    bool big_endian = SDL_AUDIO_ISBIGENDIAN(format) != 0;
+    for (int i = 0; i < samples; i++)
+    {
+        u08 *p = input + i*bytes;
+        u32 raw = 0;
+        for (int b = 0; b < bytes; b++)
+            raw |= (u32)p[big_endian ? bytes - 1 - b : b] << (8*b);
+        if (SDL_AUDIO_ISFLOAT(format))
+        {
+            SDL_memcpy(&output[i], &raw, sizeof(r32));
+            continue;
+        }
+        if (!SDL_AUDIO_ISSIGNED(format))
+            raw ^= 1u << (bits - 1);
+        s32 value = (s32)(raw << (32 - bits));
+        output[i] = (r32)value / 2147483648.0f;
+    }
+}
+
+// Folds more than two channels down to stereo in place. Channels
+// are in WAVE order (FL FR FC LFE BL BR SL SR); the centre and
+// surrounds are mixed in at -3 dB, the LFE is dropped, and each
+// side is scaled by its total weight so it cannot clip.
+void audio_downmix_to_stereo(r32 *buffer, int frames, int channels)
+{
+    bool has_centre = channels == 3 || channels >= 5;
+    bool has_lfe = channels == 6 || channels == 8;
+    int first_surround = 2 + has_centre + has_lfe;
+    r32 side = 0.7071f;
+    r32 weight = 1.0f + (has_centre ? side : 0.0f) +
+                 side*((channels - first_surround + 1) / 2);
+    for (int i = 0; i < frames; i++)
+    {
+        r32 *in = buffer + i*channels;
+        r32 l = in[0];
+        r32 r = in[1];
+        if (has_centre)
+        {
+            l += side*in[2];
+            r += side*in[2];
+        }
+        for (int c = first_surround; c < channels; c++)
+        {
+            if ((c - first_surround) % 2 == 0) l += side*in[c];
+            else                               r += side*in[c];
+        }
+        buffer[2*i+0] = l / weight;
+        buffer[2*i+1] = r / weight;
+    }
+}
+
+// Zeroth order modified Bessel function of the first kind, for the
+// Kaiser window.
+double audio_bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++)
+    {
+        term *= (x / (2.0*k)) * (x / (2.0*k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Kaiser windowed sinc resampling. The filter reaches this many
+// zero crossings of the lower of the two rates on each side, and
+// is tabulated at Audio_Resample_Phases points per input sample
+// with linear interpolation in between. The cutoff sits a little
+// below the lower Nyquist frequency so that the transition band
+// does not alias.
+#define Audio_Resample_Zero_Crossings 16
+#define Audio_Resample_Phases 256
+#define Audio_Resample_Beta 8.6
+#define Audio_Resample_Rolloff 0.95
+
+// Resamples _frames_ interleaved frames from in_rate to out_rate.
+// Returns a new buffer allocated with SDL_malloc, and the number
+// of frames in it in _out_frames_.
+r32 *audio_resample(r32 *input, int frames, int channels,
+                    int in_rate, int out_rate, int *out_frames)
+{
+    Assert(channels <= Audio_Channels);
+    double cutoff = Audio_Resample_Rolloff;
+    if (out_rate < in_rate)
+        cutoff *= (double)out_rate / in_rate;
+    int width = (int)SDL_ceil(Audio_Resample_Zero_Crossings / cutoff);
+
+    // One side of the symmetric filter, in steps of 1/Phases of an
+    // input sample, plus a guard entry for the interpolation.
+    int table_size = width*Audio_Resample_Phases + 2;
+    r32 *table = (r32*)SDL_malloc(table_size*sizeof(r32));
+    double pi = 3.14159265358979323846;
+    double i0_beta = audio_bessel_i0(Audio_Resample_Beta);
+    for (int j = 0; j < table_size; j++)
+    {
+        double t = (double)j / Audio_Resample_Phases;
+        double x = t / width;
+        double window = x < 1.0 ? audio_bessel_i0(Audio_Resample_Beta*SDL_sqrt(1.0 - x*x)) / i0_beta : 0.0;
+        double sinc = j == 0 ? 1.0 : SDL_sin(pi*cutoff*t) / (pi*cutoff*t);
+        table[j] = (r32)(cutoff*sinc*window);
+    }
+
+    int count = (int)(((u64)frames*out_rate) / in_rate);
+    r32 *output = (r32*)SDL_malloc((count > 0 ? count : 1)*channels*sizeof(r32));
+    for (int i = 0; i < count; i++)
+    {
+        // Exact position of the output frame in the input.
+        u64 position = (u64)i*in_rate;
+        int center = (int)(position / out_rate);
+        r32 frac = (r32)(position % out_rate) / (r32)out_rate;
+
+        int first = center - width + 1;
+        int last = center + width;
+        if (first < 0) first = 0;
+        if (last > frames - 1) last = frames - 1;
+
+        r32 sum[Audio_Channels] = {};
+        for (int n = first; n <= last; n++)
+        {
+            r32 t = (r32)(n - center) - frac;
+            t = (t < 0.0f ? -t : t) * Audio_Resample_Phases;
+            int j = (int)t;
+            r32 h = table[j] + (t - j)*(table[j+1] - table[j]);
+            for (int c = 0; c < channels; c++)
+                sum[c] += h*input[n*channels + c];
+        }
+        for (int c = 0; c < channels; c++)
+            output[i*channels + c] = sum[c];
+    }
+    SDL_free(table);
+    *out_frames = count;
+    return output;
+}
+
+// Makes a source in the mixer format out of _frames_ frames of
+// interleaved samples in any format that audio_decode_to_r32 can
+// read. The data is copied, so the caller still owns it.
+audio_Source audio_convert_source(u08 *data, int frames, SDL_AudioFormat format,
+                                  int channels, int freq)
+{
+    r32 *samples = (r32*)SDL_malloc((frames > 0 ? frames : 1)*channels*sizeof(r32));
+    audio_decode_to_r32(samples, data, frames*channels, format);
+
+    if (channels > Audio_Channels)
+    {
+        audio_downmix_to_stereo(samples, frames, channels);
+        channels = Audio_Channels;
+    }
+    if (freq != Audio_Sample_Rate)
+    {
+        r32 *resampled = audio_resample(samples, frames, channels,
+                                        freq, Audio_Sample_Rate,
+                                        &frames);
+        SDL_free(samples);
+        samples = resampled;
+    }
+
+    s16 *converted = (s16*)SDL_malloc((frames > 0 ? frames : 1)*channels*sizeof(s16));
+    audio_convert(converted, samples, frames*channels);
+    SDL_free(samples);
+    Printf("Converted to: %d Hz, %d channels, 16 bits\n", Audio_Sample_Rate, channels);
+    return make_source(converted, frames*channels, channels);
+}
+
+// Loads a WAV file in any of these formats
+//  - 8, 16, 24 or 32-bit integer, or 32-bit float samples
+//  - any sample rate
+//  - any number of channels; more than two are folded to stereo
+// and converts it to the mixer format, unless it already is.
+audio_Source audio_load(char *filename)
+{
+    SDL_AudioSpec spec;
+    u08 *buffer;
+    u32 length_in_bytes;
+
+    if (!SDL_LoadWAV(filename, &spec, &buffer, &length_in_bytes) &&
+        !audio_load_riff(filename, &spec, &buffer, &length_in_bytes))
+    {
+        Printf("Failed to load WAV\n");
+        Assert(false);
+        return make_source(0, 0);
+    }
+
+    int channels = spec.channels;
+    int frames = length_in_bytes / (channels*(SDL_AUDIO_BITSIZE(spec.format)/8));
+    r32 duration = frames / (r32)spec.freq;
+
+    Printf("Loaded %s\n", filename);
+    Printf("Frequency: %d\n", spec.freq);
+    Printf("Channels: %d\n", spec.channels);
+    Printf("Buffer: %d bytes per unit\n", spec.samples);
+    Printf("Bits/Sample: %d\n", SDL_AUDIO_BITSIZE(spec.format));
+    Printf("Signed: %d\n", SDL_AUDIO_ISSIGNED(spec.format));
+    Printf("LEndian: %d\n", SDL_AUDIO_ISLITTLEENDIAN(spec.format));
+    Printf("Float: %d\n", SDL_AUDIO_ISFLOAT(spec.format));
+    Printf("Format: 0x%x\n", spec.format);
+    Printf("Total size: %d bytes\n", length_in_bytes);
+    Printf("Duration: = %.2f s\n", duration);
+
+    // Mono is mixed as is, so it takes half the memory of stereo.
+    audio_Source result = {};
+    if (spec.format == AUDIO_S16SYS &&
+        spec.freq == Audio_Sample_Rate &&
+        channels <= Audio_Channels)
+    {
+        result = make_source((s16*)buffer, frames*channels, channels);
+    }
+    else
+    {
+        result = audio_convert_source(buffer, frames, spec.format, channels, spec.freq);
+        SDL_FreeWAV(buffer);
+    }
+    Printf("Loudness: %.3f\n", result.loudness);
+
+    return result;
+}
+
+// Memory mapped WAV files
+//
+// audio_map_wav maps the file read-only and points the source
+// straight at its data chunk, so nothing is copied, the pages are
+// shared through the page cache, and they only count as private
+// memory if they are written to, which the mixer never does. Files
+// that are not already in the mixer format are converted like
+// audio_load would, and the mapping is dropped. Mapped sources,
+// like loaded ones, live until the program exits.
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+enum audio_MapFlags
+{
+    Audio_Map_Default = 0,
+    Audio_Map_Prefetch = 1, // Ask the OS to start reading the file in now
+    Audio_Map_Lock = 2      // Keep the pages resident, so that the audio
+                            // thread never waits on a page fault
+};
+
+// Maps the whole file read-only. Returns 0 on failure.
+u08 *audio_map_file(char *filename, s32 *size)
+{
+    #ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+        return 0;
+    LARGE_INTEGER file_size;
+    u08 *view = 0;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0 &&
+        file_size.QuadPart < 0x7fffffff)
+    {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping)
+        {
+            view = (u08*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+        *size = (s32)file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return view;
+    #else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat info;
+    void *view = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0 && info.st_size < 0x7fffffff)
+    {
+        view = mmap(0, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        *size = (s32)info.st_size;
+    }
+    close(fd); // the mapping keeps the file open
+    return view == MAP_FAILED ? 0 : (u08*)view;
+    #endif
+}
+
+void audio_unmap_file(u08 *view, s32 size)
+{
+    #ifdef _WIN32
+    UnmapViewOfFile(view);
+    #else
+    munmap(view, (size_t)size);
+    #endif
+}
+
+void audio_prefetch(u08 *data, u32 size)
+{
+    #ifndef _WIN32
+    // madvise wants a page aligned start
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)data & ~(page - 1);
+    madvise((void*)start, (uintptr_t)data + size - start, MADV_WILLNEED);
+    #endif
+}
+
+bool audio_lock_pages(u08 *data, u32 size)
+{
+    #ifdef _WIN32
+    return VirtualLock(data, size) != 0;
+    #else
+    return mlock(data, size) == 0;
+    #endif
+}
+
+audio_Source audio_map_wav(char *filename, int flags = Audio_Map_Prefetch)
+{
+    s32 size = 0;
+    u08 *file = audio_map_file(filename, &size);
+    SDL_AudioSpec spec;
+    u08 *data = 0;
+    u32 data_size = 0;
+    if (!file || !audio_parse_riff(file, size, &spec, &data, &data_size))
+    {
+        Printf("Failed to map WAV %s\n", filename);
+        Assert(false);
+        if (file)
+            audio_unmap_file(file, size);
+        return make_source(0, 0);
+    }
+
+    int channels = spec.channels;
+    int frames = data_size / (channels*(SDL_AUDIO_BITSIZE(spec.format)/8));
+    bool direct = (spec.format == AUDIO_S16SYS &&
+                   spec.freq == Audio_Sample_Rate &&
+                   channels <= Audio_Channels &&
+                   ((uintptr_t)data & 1) == 0);
+    if (!direct)
+    {
+        audio_Source result = audio_convert_source(data, frames, spec.format, channels, spec.freq);
+        audio_unmap_file(file, size);
+        return result;
+    }
+
+    if (flags & Audio_Map_Prefetch)
+        audio_prefetch(data, data_size);
+    if ((flags & Audio_Map_Lock) && !audio_lock_pages(data, data_size))
+        Printf("Could not lock %s in memory\n", filename);
+
+    Printf("Mapped %s: %d Hz, %d channels, %.2f s\n", filename,
+           spec.freq, channels, frames / (r32)spec.freq);
+    return make_source((s16*)data, frames*channels, channels);
+}
+
+// Ogg Vorbis sound effects are decoded whole when they are loaded,
+// so they cost the same to mix as a WAV. The decoded sources are
+// cached by path and modification time, so loading the same file
+// again is only a lookup, and a file that changed on disk is
+// decoded again. Sources are never freed, because streams may
+// still be playing them. The cache is shared by the load workers,
+// and the lock is only held to look up and insert, not to decode.
+#define Audio_Max_Cached_Ogg 256
+
+struct audio_OggCacheEntry
+{
+    u32 hash;
+    char *path;
+    time_t mtime;
+    audio_Source source;
+};
+
+struct audio_OggCache
+{
+    audio_OggCacheEntry entries[Audio_Max_Cached_Ogg];
+    int count;
+    SDL_SpinLock lock;
+} audio_ogg_cache;
+
+// FNV-1a
+u32 audio_hash_string(const char *s)
+{
+    u32 hash = 2166136261u;
+    for (; *s; s++)
+        hash = (hash ^ (u08)*s) * 16777619u;
+    return hash;
+}
+
+// Modification time of a file, or -1 if it can't be read.
+time_t audio_file_mtime(char *filename)
+{
+    #ifdef _WIN32
+    struct _stat64 info;
+    if (_stat64(filename, &info) != 0)
+        return -1;
+    #else
+    struct stat info;
+    if (stat(filename, &info) != 0)
+        return -1;
+    #endif
+    return (time_t)info.st_mtime;
+}
+
+// Call with the cache locked.
+audio_OggCacheEntry *audio_ogg_cache_find(u32 hash, char *filename)
+{
+    for (int i = 0; i < audio_ogg_cache.count; i++)
+    {
+        audio_OggCacheEntry *entry = audio_ogg_cache.entries + i;
+        if (entry->hash == hash && SDL_strcmp(entry->path, filename) == 0)
+            return entry;
+    }
+    return 0;
+}
+
+audio_Source audio_load_ogg(char *filename)
+{
+    u32 hash = audio_hash_string(filename);
+    time_t mtime = audio_file_mtime(filename);
+    SDL_AtomicLock(&audio_ogg_cache.lock);
+    audio_OggCacheEntry *entry = audio_ogg_cache_find(hash, filename);
+    if (entry && entry->mtime == mtime)
+    {
+        audio_Source result = entry->source;
+        SDL_AtomicUnlock(&audio_ogg_cache.lock);
+        return result;
+    }
+    SDL_AtomicUnlock(&audio_ogg_cache.lock);
+
+    SDL_RWops *rw = SDL_RWFromFile(filename, "rb");
+    if (!rw)
+    {
+        Printf("Failed to open %s\n", filename);
+        Assert(false);
+        return make_source(0, 0);
+    }
+    s32 size = (s32)SDL_RWsize(rw);
+    u08 *file = (u08*)SDL_malloc(size > 0 ? size : 1);
+    bool ok = size > 0 && SDL_RWread(rw, file, size, 1) == 1;
+    SDL_RWclose(rw);
+
+    int channels = 0;
+    int freq = 0;
+    s16 *decoded = 0;
+    int frames = ok ? stb_vorbis_decode_memory(file, size, &channels, &freq, &decoded) : -1;
+    SDL_free(file);
+    if (frames < 0)
+    {
+        Printf("Failed to decode %s\n", filename);
+        Assert(false);
+        return make_source(0, 0);
+    }
+
+    audio_Source result = {};
+    if (freq == Audio_Sample_Rate && channels <= Audio_Channels)
+    {
+        result = make_source(decoded, frames*channels, channels);
+    }
+    else
+    {
+        result = audio_convert_source((u08*)decoded, frames, AUDIO_S16SYS, channels, freq);
+        free(decoded); // allocated by stb_vorbis
+    }
+    Printf("Loaded %s\n", filename);
+    Printf("Frequency: %d\n", freq);
+    Printf("Channels: %d\n", channels);
+    Printf("Duration: = %.2f s\n", frames / (r32)freq);
+    Printf("Loudness: %.3f\n", result.loudness);
+
+    SDL_AtomicLock(&audio_ogg_cache.lock);
+    entry = audio_ogg_cache_find(hash, filename);
+    if (!entry && audio_ogg_cache.count < Audio_Max_Cached_Ogg)
+    {
+        entry = audio_ogg_cache.entries + audio_ogg_cache.count;
+        entry->hash = hash;
+        entry->path = SDL_strdup(filename);
+        audio_ogg_cache.count++;
+    }
+    if (entry)
+    {
+        entry->mtime = mtime;
+        entry->source = result;
+    }
+    SDL_AtomicUnlock(&audio_ogg_cache.lock);
+    return result;
+}
+
+// Sound banks
+//
+// A bank is a single file with every sound already in the mixer
+// format, so loading a sound is a hash lookup into one mapping
+// instead of opening, parsing and converting a file. The bank tool
+// (bank.cpp) writes it. Layout, all little-endian:
+//
+//   audio_BankHeader
+//   audio_BankEntry[table_size]  open addressed hash table of names
+//   s16 samples...               each sound 16 byte aligned
+//
+// An entry with hash 0 is empty. Sounds are found by the FNV-1a
+// hash of their name, probing linearly; the tool refuses names
+// whose hashes collide, so a hash match is a name match.
+#define Audio_Bank_Magic 0x4b4e4142 // "BANK"
+#define Audio_Bank_Version 1
+
+struct audio_BankHeader
+{
+    u32 magic;
+    u32 version;
+    u32 num_sounds;
+    u32 table_size; // Power of two, at least twice num_sounds
+};
+
+struct audio_BankEntry
+{
+    u32 hash;
+    u32 offset;     // Bytes from the start of the file
+    u32 length;     // Number of interleaved samples
+    u32 channels;
+    u32 loop_start; // Sample a repeating stream goes back to
+    r32 loudness;   // Measured by the tool, so loading never reads the samples
+};
+
+struct audio_Bank
+{
+    u08 *file;
+    s32 size;
+    audio_BankHeader *header;
+    audio_BankEntry *entries;
+};
+
+// Names hash to 0 only by accident; 0 marks empty slots.
+u32 audio_bank_hash(const char *name)
+{
+    u32 hash = audio_hash_string(name);
+    return hash ? hash : 1;
+}
+
+// Maps a bank file. Returns false if it is missing or malformed.
+bool audio_bank_open(audio_Bank *bank, char *filename, int flags = Audio_Map_Prefetch)
+{
+    SDL_zerop(bank);
+    #if SDL_BYTEORDER != SDL_LIL_ENDIAN
+    Printf("Sound banks are little-endian only\n");
+    return false;
+    #endif
+    bank->file = audio_map_file(filename, &bank->size);
+    if (!bank->file)
+        return false;
+
+    audio_BankHeader *header = (audio_BankHeader*)bank->file;
+    u32 table_size = header->table_size;
+    bool ok = ((u32)bank->size >= sizeof(audio_BankHeader) &&
+               header->magic == Audio_Bank_Magic &&
+               header->version == Audio_Bank_Version &&
+               table_size > 0 && (table_size & (table_size - 1)) == 0 &&
+               table_size <= ((u32)bank->size - sizeof(audio_BankHeader)) / sizeof(audio_BankEntry));
+    audio_BankEntry *entries = (audio_BankEntry*)(header + 1);
+    for (u32 i = 0; ok && i < table_size; i++)
+    {
+        audio_BankEntry *entry = entries + i;
+        if (entry->hash == 0)
+            continue;
+        ok = ((entry->channels == 1 || entry->channels == 2) &&
+              entry->offset % 2 == 0 &&
+              entry->offset <= (u32)bank->size &&
+              entry->length <= ((u32)bank->size - entry->offset) / sizeof(s16) &&
+              entry->loop_start <= entry->length &&
+              entry->loop_start % entry->channels == 0);
+    }
+    if (!ok)
+    {
+        Printf("Invalid sound bank %s\n", filename);
+        audio_unmap_file(bank->file, bank->size);
+        SDL_zerop(bank);
+        return false;
+    }
+
+    bank->header = header;
+    bank->entries = entries;
+    if (flags & Audio_Map_Prefetch)
+        audio_prefetch(bank->file, bank->size);
+    if ((flags & Audio_Map_Lock) && !audio_lock_pages(bank->file, bank->size))
+        Printf("Could not lock %s in memory\n", filename);
+    Printf("Opened bank %s: %d sounds\n", filename, header->num_sounds);
+    return true;
+}
+
+// Returns the slot for the name, or an empty slot if it is not in
+// the bank.
+audio_BankEntry *audio_bank_find(audio_BankEntry *entries, u32 table_size, u32 hash)
+{
+    u32 mask = table_size - 1;
+    u32 i = hash & mask;
+    while (entries[i].hash != 0 && entries[i].hash != hash)
+        i = (i + 1) & mask;
+    return entries + i;
+}
+
+// Looks a sound up by name. The source points into the bank, so
+// the bank must stay open while it plays. Returns an empty source
+// if there is no such sound.
+audio_Source audio_bank_source(audio_Bank *bank, const char *name)
+{
+    audio_Source result = {};
+    result.channels = Audio_Channels;
+    if (!bank->header)
+        return result;
+    audio_BankEntry *entry = audio_bank_find(bank->entries, bank->header->table_size,
+                                             audio_bank_hash(name));
+    if (entry->hash == 0)
+    {
+        Printf("No sound named %s in bank\n", name);
+        return result;
+    }
+    result.buffer = (s16*)(bank->file + entry->offset);
+    result.length = entry->length;
+    result.channels = entry->channels;
+    result.loop_start = entry->loop_start;
+    result.loudness = entry->loudness;
+    return result;
+}
+
+void audio_bank_close(audio_Bank *bank)
+{
+    if (bank->file)
+        audio_unmap_file(bank->file, bank->size);
+    SDL_zerop(bank);
+}
+
+// Parallel loading
+//
+// audio_load_many loads a batch of files on a pool of worker
+// threads, one per core besides the game thread. Paths ending in
+// .ogg go through audio_load_ogg and everything else through
+// audio_map_wav, with the Audio_Map flags given for that path in
+// _map_flags_, or Audio_Map_Prefetch if it is null. The async
+// variant returns a ticket that the game polls with
+// audio_load_ready, so a level can load while frames keep going.
+// The paths and the sources array must stay valid until the
+// ticket is ready. If Audio_Max_Load_Tickets batches are
+// already loading, the async variant starts nothing and returns
+// Audio_Invalid_Ticket, which is never ready, so try again later.
+// Called from the game thread only.
+#define Audio_Max_Load_Workers 16
+#define Audio_Max_Load_Jobs 1024
+#define Audio_Max_Load_Tickets 64
+
+typedef int audio_LoadTicket;
+#define Audio_Invalid_Ticket -1
+
+struct audio_LoadJob
+{
+    char *path;
+    audio_Source *source;
+    int map_flags;
+    audio_LoadTicket ticket;
+};
+
+struct audio_Loader
+{
+    // Ring of jobs waiting for a worker, guarded by _lock_. The
+    // semaphore counts the jobs in it.
+    audio_LoadJob jobs[Audio_Max_Load_Jobs];
+    int first_job;
+    int num_jobs;
+    SDL_mutex *lock;
+    SDL_sem *jobs_ready;
+
+    // Number of jobs of each ticket that are not done yet, or -1
+    // if the ticket is free.
+    SDL_atomic_t tickets[Audio_Max_Load_Tickets];
+
+    SDL_Thread *workers[Audio_Max_Load_Workers];
+    int num_workers;
+} audio_loader;
+
+bool audio_is_ogg(char *path)
+{
+    int length = (int)SDL_strlen(path);
+    return length > 4 && SDL_strcasecmp(path + length - 4, ".ogg") == 0;
+}
+
+// Takes the next job off the queue. Call after a successful wait
+// on jobs_ready.
+audio_LoadJob audio_pop_load_job()
+{
+    SDL_LockMutex(audio_loader.lock);
+    audio_LoadJob job = audio_loader.jobs[audio_loader.first_job];
+    audio_loader.first_job = (audio_loader.first_job + 1) % Audio_Max_Load_Jobs;
+    audio_loader.num_jobs--;
+    SDL_UnlockMutex(audio_loader.lock);
+    return job;
+}
+
+void audio_run_load_job(audio_LoadJob job)
+{
+    if (audio_is_ogg(job.path))
+        *job.source = audio_load_ogg(job.path);
+    else
+        *job.source = audio_map_wav(job.path, job.map_flags);
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicAdd(&audio_loader.tickets[job.ticket], -1);
+}
+
+int audio_load_worker(void *data)
+{
+    for (;;)
+    {
+        SDL_SemWait(audio_loader.jobs_ready);
+        audio_run_load_job(audio_pop_load_job());
+    }
+    return 0;
+}
+
+void audio_start_loader()
+{
+    audio_loader.lock = SDL_CreateMutex();
+    audio_loader.jobs_ready = SDL_CreateSemaphore(0);
+    for (int i = 0; i < Audio_Max_Load_Tickets; i++)
+        SDL_AtomicSet(&audio_loader.tickets[i], -1);
+
+    int workers = SDL_GetCPUCount() - 1;
+    if (workers < 1) workers = 1;
+    if (workers > Audio_Max_Load_Workers) workers = Audio_Max_Load_Workers;
+    for (int i = 0; i < workers; i++)
+        audio_loader.workers[i] = SDL_CreateThread(audio_load_worker, "audio_load", 0);
+    audio_loader.num_workers = workers;
+}
+
+// The Audio_Map flags the i-th file of a batch is mapped with.
+int audio_load_flags(int *map_flags, int i)
+{
+    return map_flags ? map_flags[i] : Audio_Map_Prefetch;
+}
+
+audio_LoadTicket audio_load_many_async(char **paths, int count, audio_Source *sources,
+                                       int *map_flags = 0)
+{
+    if (!audio_loader.lock)
+        audio_start_loader();
+
+    audio_LoadTicket ticket = Audio_Invalid_Ticket;
+    for (int i = 0; i < Audio_Max_Load_Tickets; i++)
+    {
+        if (SDL_AtomicGet(&audio_loader.tickets[i]) == -1)
+        {
+            ticket = i;
+            break;
+        }
+    }
+    if (ticket == Audio_Invalid_Ticket)
+    {
+        Printf("Too many batches loading at once\n");
+        return ticket;
+    }
+    SDL_AtomicSet(&audio_loader.tickets[ticket], count);
+
+    for (int i = 0; i < count; i++)
+    {
+        audio_LoadJob job = {};
+        job.path = paths[i];
+        job.source = sources + i;
+        job.map_flags = audio_load_flags(map_flags, i);
+        job.ticket = ticket;
+
+        SDL_LockMutex(audio_loader.lock);
+        bool queued = audio_loader.num_jobs < Audio_Max_Load_Jobs;
+        if (queued)
+        {
+            int index = (audio_loader.first_job + audio_loader.num_jobs) % Audio_Max_Load_Jobs;
+            audio_loader.jobs[index] = job;
+            audio_loader.num_jobs++;
+        }
+        SDL_UnlockMutex(audio_loader.lock);
+
+        // Load it here rather than wait for room in the queue.
+        if (queued)
+            SDL_SemPost(audio_loader.jobs_ready);
+        else
+            audio_run_load_job(job);
+    }
+    return ticket;
+}
+
+// Returns true once every file of the batch is loaded. The ticket
+// is then finished and must not be used again. An invalid ticket
+// started no batch, so it is never ready.
+bool audio_load_ready(audio_LoadTicket ticket)
+{
+    if (ticket < 0 || ticket >= Audio_Max_Load_Tickets)
+        return false;
+    if (SDL_AtomicGet(&audio_loader.tickets[ticket]) != 0)
+        return false;
+    SDL_MemoryBarrierAcquire();
+    SDL_AtomicSet(&audio_loader.tickets[ticket], -1);
+    return true;
+}
+
+// Blocks until the batch is loaded, loading files from the queue
+// on this thread too while it waits. Must be given a valid ticket.
+void audio_load_wait(audio_LoadTicket ticket)
+{
+    Assert(ticket >= 0 && ticket < Audio_Max_Load_Tickets);
+    while (!audio_load_ready(ticket))
+    {
+        if (SDL_SemTryWait(audio_loader.jobs_ready) == 0)
+            audio_run_load_job(audio_pop_load_job());
+        else
+            SDL_Delay(1);
+    }
+}
+
+void audio_load_many(char **paths, int count, audio_Source *sources,
+                     int *map_flags = 0)
+{
+    audio_LoadTicket ticket = audio_load_many_async(paths, count, sources, map_flags);
+    if (ticket != Audio_Invalid_Ticket)
+    {
+        audio_load_wait(ticket);
+        return;
+    }
+
+    // No ticket to spare, so load the batch on this thread
+    for (int i = 0; i < count; i++)
+    {
+        if (audio_is_ogg(paths[i]))
+            sources[i] = audio_load_ogg(paths[i]);
+        else
+            sources[i] = audio_map_wav(paths[i], audio_load_flags(map_flags, i));
+    }
+}
+
+// Streaming
+//
+// Long sounds like music are decoded from Ogg Vorbis while they
+// play, a few hundred milliseconds ahead, instead of being loaded
+// whole. Streamed files must be at Audio_Sample_Rate; they are not
+// resampled. Files with more than two channels are decoded to stereo.
+
+// Tops up the ring of one decoder. Returns true if it decoded
+// anything.
+bool audio_decode(audio_Decoder *decoder)
+{
+    u32 write = (u32)SDL_AtomicGet(&decoder->write);
+    int request = SDL_AtomicGet(&decoder->seek_request);
+    if (request != SDL_AtomicGet(&decoder->seek_done))
+    {
+        SDL_MemoryBarrierAcquire();
+        unsigned int frame = (unsigned int)SDL_AtomicGet(&decoder->seek_frame);
+        bool moved = true;
+        if (frame == 0)
+            stb_vorbis_seek_start(decoder->vorbis);
+        else
+            moved = stb_vorbis_seek(decoder->vorbis, frame) != 0;
+        if (moved)
+        {
+            decoder->decoded_frame = frame;
+            SDL_AtomicSet(&decoder->finished, 0);
+        }
+        SDL_AtomicSet(&decoder->seek_at, (int)write);
+        SDL_AtomicSet(&decoder->seek_reached, (int)decoder->decoded_frame);
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&decoder->seek_done, request);
+    }
+    if (SDL_AtomicGet(&decoder->finished))
+    {
+        // play was called with Audio_Repeat after we reached the end
+        if (!SDL_AtomicGet(&decoder->repeat))
+            return false;
+        stb_vorbis_seek_start(decoder->vorbis);
+        decoder->decoded_frame = 0;
+        SDL_AtomicSet(&decoder->finished, 0);
+    }
+
+    bool decoded = false;
+    int channels = decoder->channels;
+    u32 read = (u32)SDL_AtomicGet(&decoder->read);
+    SDL_MemoryBarrierAcquire();
+    while (Audio_Decoder_Ring_Samples - (write - read) >= (u32)channels)
+    {
+        u32 index = write % Audio_Decoder_Ring_Samples;
+        int space = Audio_Decoder_Ring_Samples - (int)(write - read);
+        int to_end = Audio_Decoder_Ring_Samples - (int)index;
+        int samples = space < to_end ? space : to_end;
+        int frames = stb_vorbis_get_samples_short_interleaved(decoder->vorbis, channels,
+                                                              decoder->ring + index,
+                                                              samples - samples % channels);
+        if (frames == 0)
+        {
+            if (SDL_AtomicGet(&decoder->repeat) && decoder->length > 0)
+            {
+                stb_vorbis_seek_start(decoder->vorbis);
+                decoder->decoded_frame = 0;
+                continue;
+            }
+            // The callback reads _finished_ before _write_, so it
+            // can not see the end before the last samples.
+            SDL_MemoryBarrierRelease();
+            SDL_AtomicSet(&decoder->write, (int)write);
+            SDL_AtomicSet(&decoder->finished, 1);
+            return true;
+        }
+        write += frames*channels;
+        decoder->decoded_frame += frames;
+        decoded = true;
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&decoder->write, (int)write);
+    return decoded;
+}
+
+// Reports how much of its arena a closing stream used, but only
+// the first time its file uses that much, since the same few
+// sounds are opened and closed over and over.
+void audio_note_arena_use(audio_Decoder *decoder)
+{
+    int used = stb_vorbis_get_alloc_high_water(decoder->vorbis);
+    audio_ArenaUse *use = 0;
+    for (int i = 0; i < Audio_Max_Arena_Uses && !use; i++)
+    {
+        if (SDL_strcmp(audio.arena_uses[i].name, decoder->name) == 0)
+            use = audio.arena_uses + i;
+    }
+    if (!use)
+    {
+        use = audio.arena_uses + audio.next_arena_use;
+        audio.next_arena_use = (audio.next_arena_use + 1) % Audio_Max_Arena_Uses;
+        SDL_strlcpy(use->name, decoder->name, sizeof(use->name));
+        use->high_water = 0;
+    }
+    if (used > use->high_water)
+    {
+        use->high_water = used;
+        Printf("%s used %d of %d decoder arena bytes\n", decoder->name,
+               used, audio.decoder_arena_bytes);
+    }
+}
+
+int audio_decode_thread(void *data)
+{
+    for (;;)
+    {
+        bool busy = false;
+        for (int i = 0; i < Audio_Max_Decoders; i++)
+        {
+            audio_Decoder *decoder = audio.decoders + i;
+            int state = SDL_AtomicGet(&decoder->state);
+            if (state == Audio_Decoder_Open)
+            {
+                busy |= audio_decode(decoder);
+            }
+            else if (state == Audio_Decoder_Closing)
+            {
+                if (decoder->in_arena)
+                    audio_note_arena_use(decoder);
+                stb_vorbis_close(decoder->vorbis);
+                decoder->vorbis = 0;
+                SDL_AtomicSet(&decoder->state, Audio_Decoder_Free);
+            }
+        }
+        if (!busy)
+            SDL_Delay(Audio_Decode_Interval_Ms);
+    }
+    return 0;
+}
+
+// Gives every decoder an arena that stb_vorbis allocates all its
+// memory from, so that opening and closing streams no longer goes
+// to the heap. The arenas are allocated and touched here, so call
+// this at startup, before any stream is opened. When a stream is
+// closed, its file reports how much of an arena it used if that is
+// more than before; a stream that does not fit is decoded from the
+// heap instead, and says so.
+void audio_reserve_decoders(int arena_bytes)
+{
+    Assert(!audio.decode_thread);
+    for (int i = 0; i < Audio_Max_Decoders; i++)
+    {
+        audio_Decoder *decoder = audio.decoders + i;
+        SDL_free(decoder->arena);
+        decoder->arena = (char*)SDL_malloc(arena_bytes);
+        SDL_memset(decoder->arena, 0, arena_bytes);
+    }
+    audio.decoder_arena_bytes = arena_bytes;
+}
+
+// Returns a free decoder, or 0 if all are in use. Called from the
+// game thread only.
+audio_Decoder *audio_claim_decoder()
+{
+    for (int i = 0; i < Audio_Max_Decoders; i++)
+    {
+        audio_Decoder *decoder = audio.decoders + i;
+        if (SDL_AtomicCAS(&decoder->state, Audio_Decoder_Free, Audio_Decoder_Claimed))
+            return decoder;
+    }
+    Printf("Out of streams for Ogg Vorbis\n");
+    return 0;
+}
+
+// Returns the parsed headers of the file, or of the data if it is
+// not null, parsing them the first time. The codebooks and IMDCT
+// tables are most of what opening a stream allocates and most of
+// the time it takes, so streams of the same sound share one copy,
+// kept here until audio_forget_vorbis_setups. Memory is looked up
+// by address, so forget the setups before reusing it for other
+// data. A file that changed since it was parsed is parsed again.
+// Returns 0 if the headers can not be parsed.
+stb_vorbis_setup *audio_vorbis_setup(char *filename, u08 *data, int length)
+{
+    time_t mtime = data ? 0 : audio_file_mtime(filename);
+    audio_VorbisSetup *slot = 0;
+    for (int i = 0; i < Audio_Max_Vorbis_Setups; i++)
+    {
+        audio_VorbisSetup *cached = audio.vorbis_setups + i;
+        if (!cached->setup)
+            continue;
+        if (data ? (cached->data == data && cached->length == length) :
+                   (!cached->data && SDL_strcmp(cached->filename, filename) == 0))
+        {
+            if (data || cached->mtime == mtime)
+                return cached->setup;
+            slot = cached;
+            break;
+        }
+    }
+
+    int error = 0;
+    stb_vorbis *vorbis = (data ?
+                          stb_vorbis_open_memory(data, length, &error, 0) :
+                          stb_vorbis_open_filename(filename, &error, 0));
+    if (!vorbis)
+        return 0;
+    // Shared with the setup, so every stream seeks with it
+    stb_vorbis_build_seek_table(vorbis);
+    stb_vorbis_setup *setup = stb_vorbis_get_setup(vorbis);
+    stb_vorbis_close(vorbis);
+    if (!setup)
+        return 0;
+
+    // The setup of a file that changed is replaced in place
+    if (!slot)
+    {
+        slot = audio.vorbis_setups + audio.next_vorbis_setup;
+        audio.next_vorbis_setup = (audio.next_vorbis_setup + 1) % Audio_Max_Vorbis_Setups;
+    }
+    // Streams still playing keep their own reference
+    stb_vorbis_release_setup(slot->setup);
+    slot->setup = setup;
+    slot->data = data;
+    slot->length = length;
+    SDL_strlcpy(slot->filename, data ? "" : filename, sizeof(slot->filename));
+    slot->mtime = mtime;
+    return setup;
+}
+
+// Drops the cached setups. Open streams keep theirs until closed.
+void audio_forget_vorbis_setups()
+{
+    for (int i = 0; i < Audio_Max_Vorbis_Setups; i++)
+    {
+        stb_vorbis_release_setup(audio.vorbis_setups[i].setup);
+        audio.vorbis_setups[i].setup = 0;
+    }
+}
+
+// Opens Ogg Vorbis for the decoder, from a file if _data_ is null,
+// using the decoder's arena if it has one and the file fits.
+stb_vorbis *audio_open_vorbis(audio_Decoder *decoder, char *filename, u08 *data, int length)
+{
+    stb_vorbis_alloc arena = {};
+    stb_vorbis_alloc *alloc = 0;
+    decoder->in_arena = false;
+    if (decoder->arena)
+    {
+        arena.alloc_buffer = decoder->arena;
+        arena.alloc_buffer_length_in_bytes = audio.decoder_arena_bytes;
+        alloc = &arena;
+    }
+    SDL_strlcpy(decoder->name, filename ? filename : "Ogg Vorbis data", sizeof(decoder->name));
+
+    // Only the decode buffers are left to allocate
+    stb_vorbis_setup *setup = audio_vorbis_setup(filename, data, length);
+    for (;;)
+    {
+        int error = 0;
+        stb_vorbis *vorbis;
+        if (setup)
+            vorbis = (data ?
+                      stb_vorbis_open_memory_with_setup(data, length, setup, &error, alloc) :
+                      stb_vorbis_open_filename_with_setup(filename, setup, &error, alloc));
+        else
+            vorbis = (data ?
+                      stb_vorbis_open_memory(data, length, &error, alloc) :
+                      stb_vorbis_open_filename(filename, &error, alloc));
+        if (vorbis)
+        {
+            decoder->in_arena = (alloc != 0);
+            return vorbis;
+        }
+        if (error == VORBIS_outofmem && alloc)
+        {
+            Printf("%s does not fit in a %d byte decoder arena\n", decoder->name, arena.alloc_buffer_length_in_bytes);
+            alloc = 0;
+            continue;
+        }
+        Printf("Failed to open %s (stb_vorbis error %d)\n", decoder->name, error);
+        return 0;
+    }
+}
+
+// Hands a claimed decoder and its open Ogg Vorbis to the decode
+// thread and opens a stream that plays it. Takes ownership of
+// _vorbis_; on failure the decoder is free again.
+audio_id audio_start_decoder(audio_Decoder *decoder, stb_vorbis *vorbis)
+{
+    stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+    if (info.sample_rate != Audio_Sample_Rate || audio.num_free == 0)
+    {
+        if (info.sample_rate != Audio_Sample_Rate)
+            Printf("Streamed Ogg Vorbis must be %d Hz, not %d Hz\n",
+                   Audio_Sample_Rate, info.sample_rate);
+        else
+            Printf("Out of streams for Ogg Vorbis\n");
+        stb_vorbis_close(vorbis);
+        SDL_AtomicSet(&decoder->state, Audio_Decoder_Free);
+        return Audio_Invalid_Stream;
+    }
+
+    // Seeks then cost one table lookup, however long the file is
+    stb_vorbis_build_seek_table(vorbis);
+
+    decoder->vorbis = vorbis;
+    decoder->channels = info.channels > 1 ? Audio_Channels : 1;
+    decoder->length = stb_vorbis_stream_length_in_samples(vorbis) * decoder->channels;
+    decoder->consumed = 0;
+    SDL_AtomicSet(&decoder->write, 0);
+    SDL_AtomicSet(&decoder->read, 0);
+    SDL_AtomicSet(&decoder->repeat, 0);
+    SDL_AtomicSet(&decoder->finished, 0);
+    SDL_AtomicSet(&decoder->seek_frame, 0);
+    SDL_AtomicSet(&decoder->seek_request, 0);
+    SDL_AtomicSet(&decoder->seek_done, 0);
+    SDL_AtomicSet(&decoder->seek_at, 0);
+    SDL_AtomicSet(&decoder->seek_reached, 0);
+    decoder->seek_applied = 0;
+    decoder->decoded_frame = 0;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&decoder->state, Audio_Decoder_Open);
+
+    if (!audio.decode_thread)
+        audio.decode_thread = SDL_CreateThread(audio_decode_thread, "audio_decode", 0);
+
+    audio_Source source = {};
+    source.buffer = decoder->ring;
+    source.length = decoder->length;
+    source.channels = decoder->channels;
+    source.loudness = 1.0f; // unknown, so never the first to go virtual
+    source.decoder = decoder;
+    return audio_stream(source);
+}
+
+// Opens a stream that plays the Ogg Vorbis data, decoding it on
+// the decode thread as it plays. Takes ownership of _vorbis_, which
+// the caller opened without a decoder arena. Returns
+// Audio_Invalid_Stream if all decoders or streams are in use.
+// Called from the game thread only.
+audio_id audio_stream_vorbis(stb_vorbis *vorbis)
+{
+    audio_Decoder *decoder = audio_claim_decoder();
+    if (!decoder)
+    {
+        stb_vorbis_close(vorbis);
+        return Audio_Invalid_Stream;
+    }
+    decoder->in_arena = false;
+    return audio_start_decoder(decoder, vorbis);
+}
+
+audio_id audio_stream_ogg(char *filename)
+{
+    audio_Decoder *decoder = audio_claim_decoder();
+    if (!decoder)
+        return Audio_Invalid_Stream;
+    stb_vorbis *vorbis = audio_open_vorbis(decoder, filename, 0, 0);
+    if (!vorbis)
+    {
+        SDL_AtomicSet(&decoder->state, Audio_Decoder_Free);
+        return Audio_Invalid_Stream;
+    }
+    return audio_start_decoder(decoder, vorbis);
+}
+
+// The data must be kept around until the stream is closed.
+audio_id audio_stream_ogg_memory(u08 *data, int length)
+{
+    audio_Decoder *decoder = audio_claim_decoder();
+    if (!decoder)
+        return Audio_Invalid_Stream;
+    stb_vorbis *vorbis = audio_open_vorbis(decoder, 0, data, length);
+    if (!vorbis)
+    {
+        SDL_AtomicSet(&decoder->state, Audio_Decoder_Free);
+        return Audio_Invalid_Stream;
+    }
+    return audio_start_decoder(decoder, vorbis);
+}
+
+// Spectrum analyzer
+//
+// The callback copies each finished mix into a ring and does
+// nothing else. The analyzer thread takes _hop_ frames at a time
+// off the ring, and transforms the last _size_ frames, mixed down
+// to mono and under a Hann window, into a spectrum. Like the
+// decoder ring, _write_ and _read_ count samples up forever; the
+// callback only writes _write_ and the analyzer only _read_. If
+// the analyzer falls behind, the callback drops whole buffers
+// rather than wait for it.
+//
+// Each spectrum goes into one of two snapshots, and _published_
+// then points the game at it. The analyzer sets _writing_ before
+// it starts on a snapshot, so audio_read_spectrum can tell when
+// the one it copied was written over in the meantime, and retries.
+#if AUDIO_FIXED_POINT
+typedef s32 audio_MixSample;
+#define Audio_Mix_Scale (1.0f / 32768.0f)
+#else
+typedef r32 audio_MixSample;
+#define Audio_Mix_Scale 1.0f
+#endif
+
+#define Audio_Tap_Samples (16384*Audio_Channels) // ~370 ms of stereo
+#define Audio_Max_Analyzer_Size 8192
+#define Audio_Analyze_Interval_Ms 5
+
+struct audio_Spectrum
+{
+    u32 count; // Spectra so far, 0 before the first
+    int bins;  // size/2 + 1
+    r32 rms;   // Level of the frames, in range 0 to 1
+    // Of bin k, at k*Audio_Sample_Rate/size Hz. A full scale sine
+    // at the center of a bin reads 1.
+    r32 magnitude[Audio_Max_Analyzer_Size/2 + 1];
+};
+
+struct audio_Analyzer
+{
+    audio_MixSample ring[Audio_Tap_Samples];
+    SDL_atomic_t write;
+    SDL_atomic_t read;
+    SDL_atomic_t running; // Set once the analyzer is ready for the tap
+    SDL_atomic_t dropped; // Buffers the callback had no room for
+
+    // Only touched by the analyzer thread once it runs
+    int size;
+    int hop;
+    fft_Plan plan;
+    r32 *window;
+    r32 *frames;   // The last _size_ frames in mono
+    r32 *windowed;
+    r32 *real;
+    r32 *imag;
+    SDL_Thread *thread;
+
+    audio_Spectrum snapshots[2];
+    SDL_atomic_t published; // Count of the latest, in snapshots[count & 1]
+    SDL_atomic_t writing;   // Count of the one being written
+} audio_analyzer;
+
+// Called from the audio thread only.
+void audio_tap(audio_MixSample *mix, int samples)
+{
+    audio_Analyzer *analyzer = &audio_analyzer;
+    u32 write = (u32)SDL_AtomicGet(&analyzer->write);
+    u32 read = (u32)SDL_AtomicGet(&analyzer->read);
+    SDL_MemoryBarrierAcquire();
+    if (write - read + samples > Audio_Tap_Samples)
+    {
+        SDL_AtomicAdd(&analyzer->dropped, 1);
+        return;
+    }
+    int at = (int)(write & (Audio_Tap_Samples - 1));
+    int first = SDL_min(samples, Audio_Tap_Samples - at);
+    SDL_memcpy(analyzer->ring + at, mix, first*sizeof(audio_MixSample));
+    SDL_memcpy(analyzer->ring, mix + first, (samples - first)*sizeof(audio_MixSample));
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&analyzer->write, (int)(write + samples));
+}
+
+// Transforms the frames and publishes the spectrum.
+void audio_analyze()
+{
+    audio_Analyzer *analyzer = &audio_analyzer;
+    int size = analyzer->size;
+    r32 sum_squares = 0.0f;
+    for (int i = 0; i < size; i++)
+    {
+        analyzer->windowed[i] = analyzer->window[i]*analyzer->frames[i];
+        sum_squares += analyzer->frames[i]*analyzer->frames[i];
+    }
+    fft_real(&analyzer->plan, analyzer->windowed, 1, analyzer->real, analyzer->imag);
+
+    u32 count = (u32)SDL_AtomicGet(&analyzer->published) + 1;
+    SDL_AtomicSet(&analyzer->writing, (int)count);
+    SDL_MemoryBarrierRelease();
+    audio_Spectrum *spectrum = analyzer->snapshots + (count & 1);
+    spectrum->count = count;
+    spectrum->bins = size/2 + 1;
+    spectrum->rms = sqrtf(sum_squares / size);
+    for (int k = 0; k < spectrum->bins; k++)
+    {
+        r32 re = analyzer->real[k];
+        r32 im = analyzer->imag[k];
+        spectrum->magnitude[k] = sqrtf(re*re + im*im);
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&analyzer->published, (int)count);
+}
+
+int audio_analyzer_thread(void *data)
+{
+    audio_Analyzer *analyzer = &audio_analyzer;
+    int size = analyzer->size;
+    int hop = analyzer->hop;
+    for (;;)
+    {
+        u32 write = (u32)SDL_AtomicGet(&analyzer->write);
+        u32 read = (u32)SDL_AtomicGet(&analyzer->read);
+        SDL_MemoryBarrierAcquire();
+        while (write - read >= (u32)(hop*Audio_Channels))
+        {
+            SDL_memmove(analyzer->frames, analyzer->frames + hop, (size - hop)*sizeof(r32));
+            r32 *frames = analyzer->frames + size - hop;
+            for (int i = 0; i < hop; i++)
+            {
+                u32 at = (read + Audio_Channels*i) & (Audio_Tap_Samples - 1);
+                r32 l = (r32)analyzer->ring[at + 0];
+                r32 r = (r32)analyzer->ring[at + 1];
+                frames[i] = 0.5f*Audio_Mix_Scale*(l + r);
+            }
+            read += hop*Audio_Channels;
+            SDL_MemoryBarrierRelease();
+            SDL_AtomicSet(&analyzer->read, (int)read);
+            audio_analyze();
+        }
+        SDL_Delay(Audio_Analyze_Interval_Ms);
+    }
+    return 0;
+}
+
+// Starts analyzing the mix, with a new spectrum every _hop_ frames
+// of the last _size_ frames. The size must be a power of two no
+// larger than Audio_Max_Analyzer_Size, and the hop at most the
+// size, so that windows overlap or at least touch. Called once,
+// from the game thread.
+bool audio_start_analyzer(int size, int hop)
+{
+    audio_Analyzer *analyzer = &audio_analyzer;
+    Assert(!analyzer->thread);
+    if (size > Audio_Max_Analyzer_Size || hop < 1 || hop > size)
+    {
+        Printf("Analyzer size must be at most %d, and the hop from 1 to the size\n",
+               Audio_Max_Analyzer_Size);
+        return false;
+    }
+    if (!fft_create(&analyzer->plan, size))
+        return false;
+    analyzer->size = size;
+    analyzer->hop = hop;
+    analyzer->window = (r32*)SDL_malloc(size*sizeof(r32));
+    analyzer->frames = (r32*)SDL_calloc(size, sizeof(r32));
+    analyzer->windowed = (r32*)SDL_malloc(size*sizeof(r32));
+    analyzer->real = (r32*)SDL_malloc((size/2 + 1)*sizeof(r32));
+    analyzer->imag = (r32*)SDL_malloc((size/2 + 1)*sizeof(r32));
+
+    // A sine of amplitude A peaks at A/2 times the sum of the
+    // window, so scale the window to sum to 2.
+    r32 pi = 3.14159265f;
+    r32 sum = 0.0f;
+    for (int i = 0; i < size; i++)
+    {
+        analyzer->window[i] = 0.5f - 0.5f*cosf(2.0f*pi*i / size);
+        sum += analyzer->window[i];
+    }
+    for (int i = 0; i < size; i++)
+        analyzer->window[i] *= 2.0f / sum;
+
+    SDL_AtomicSet(&analyzer->published, 0);
+    SDL_AtomicSet(&analyzer->writing, 0);
+    SDL_AtomicSet(&analyzer->write, 0);
+    SDL_AtomicSet(&analyzer->read, 0);
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&analyzer->running, 1);
+    analyzer->thread = SDL_CreateThread(audio_analyzer_thread, "audio_analyze", 0);
+    return true;
+}
+
+// Copies the latest spectrum. Returns false if there is none yet.
+// Never waits on the analyzer, so it can be called from any thread.
+bool audio_read_spectrum(audio_Spectrum *result)
+{
+    audio_Analyzer *analyzer = &audio_analyzer;
+    for (;;)
+    {
+        u32 count = (u32)SDL_AtomicGet(&analyzer->published);
+        if (count == 0)
+            return false;
+        SDL_MemoryBarrierAcquire();
+        audio_Spectrum *spectrum = analyzer->snapshots + (count & 1);
+        result->count = spectrum->count;
+        result->bins = spectrum->bins;
+        result->rms = spectrum->rms;
+        SDL_memcpy(result->magnitude, spectrum->magnitude, spectrum->bins*sizeof(r32));
+        SDL_MemoryBarrierAcquire();
+        // Not written over unless the analyzer started on the
+        // spectrum after the next one
+        if ((u32)SDL_AtomicGet(&analyzer->writing) - count < 2)
+            return true;
+    }
+}
+
+// Convolution reverb
+//
+// The mix, times audio.reverb_send, is convolved with an impulse
+// response and added back in. The convolution is uniformly
+// partitioned overlap-save: the response is cut into partitions of
+// Audio_Reverb_Block frames, each kept as the spectrum of a two
+// block FFT, and every block of input is transformed once and kept
+// in a history of spectra. A block of output is the inverse FFT of
+// the sum over partitions p of partition p times the input from p
+// blocks ago, of which the second half is kept.
+//
+// The callback only sums the first Audio_Reverb_Head partitions.
+// The others only need input at least that many blocks old, so once
+// the callback has transformed block j, the reverb thread sums the
+// tail of block j + Audio_Reverb_Head into a slot and stamps it with
+// that block. The callback adds the slot if the stamp matches its
+// block, and counts the tail as late otherwise; it never waits on
+// the thread. Like the other counters, the block count goes up
+// forever and the history is masked when indexing.
+//
+// Input goes in and output comes out a whole block at a time, so
+// the reverb lags the dry mix by Audio_Reverb_Block frames.
+#define Audio_Reverb_Block Audio_Frame_Size
+#define Audio_Reverb_Bins ((Audio_Reverb_Block + 1 + 7) & ~7) // Padded for the vector loops
+#define Audio_Reverb_Head 4
+#define Audio_Reverb_Slots (Audio_Reverb_Head + 1)
+#define Audio_Max_Reverb_Seconds 10
+
+// A spectrum has Audio_Reverb_Bins real parts and then as many
+// imaginary parts for each channel.
+#define Audio_Reverb_Spectrum (Audio_Channels*2*Audio_Reverb_Bins)
+
+struct audio_Reverb
+{
+    SDL_atomic_t running; // Set once the reverb is ready for the callback
+    SDL_atomic_t late;    // Blocks whose tail was not summed in time
+
+    int partitions;
+    int history;  // Input spectra kept, a power of two
+    r32 *impulse; // Spectrum of each partition
+    r32 *inputs;  // Spectrum of input block j at j & (history - 1)
+    r32 *tails;   // Sums of the partitions past the head
+    SDL_atomic_t tail_block[Audio_Reverb_Slots]; // Block of each slot
+    SDL_atomic_t blocks; // Input blocks transformed so far
+    SDL_sem *wake;
+    SDL_Thread *thread;
+
+    // Only touched by the audio thread once running
+    fft_Plan plan;
+    r32 frames[2*Audio_Reverb_Block*Audio_Channels]; // Last two blocks of input
+    r32 wet[Audio_Reverb_Block*Audio_Channels];      // Output of the last block
+    r32 sum[Audio_Reverb_Spectrum];
+    r32 time[2*Audio_Reverb_Block];
+    int fill; // Frames of the next block so far
+} audio_reverb;
+
+// Adds partitions _first_ up to _last_ of output block _block_
+// to _sum_.
+void audio_reverb_sum(r32 *sum, u32 block, int first, int last)
+{
+    audio_Reverb *reverb = &audio_reverb;
+    for (int p = first; p < last && (u32)p <= block; p++)
+    {
+        r32 *x = reverb->inputs + ((block - p) & (reverb->history - 1))*Audio_Reverb_Spectrum;
+        r32 *h = reverb->impulse + p*Audio_Reverb_Spectrum;
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            int at = c*2*Audio_Reverb_Bins;
+            audio_convolve(sum + at, sum + at + Audio_Reverb_Bins,
+                           x + at, x + at + Audio_Reverb_Bins,
+                           h + at, h + at + Audio_Reverb_Bins, Audio_Reverb_Bins);
+        }
+    }
+}
+
+int audio_reverb_thread(void *data)
+{
+    audio_Reverb *reverb = &audio_reverb;
+    u32 done = 0;
+    for (;;)
+    {
+        SDL_SemWait(reverb->wake);
+        u32 blocks = (u32)SDL_AtomicGet(&reverb->blocks);
+        SDL_MemoryBarrierAcquire();
+        // Tails of blocks the callback has already played are no use
+        if (blocks - done > Audio_Reverb_Head)
+            done = blocks - Audio_Reverb_Head;
+        for (; done != blocks; done++)
+        {
+            // Not the slot the callback reads until the next block
+            u32 block = done + Audio_Reverb_Head;
+            int slot = (int)(block % Audio_Reverb_Slots);
+            r32 *tail = reverb->tails + slot*Audio_Reverb_Spectrum;
+            SDL_memset(tail, 0, Audio_Reverb_Spectrum*sizeof(r32));
+            audio_reverb_sum(tail, block, Audio_Reverb_Head, reverb->partitions);
+            SDL_MemoryBarrierRelease();
+            SDL_AtomicSet(&reverb->tail_block[slot], (int)block);
+        }
+    }
+    return 0;
+}
+
+// Transforms a full block of input and works out the block of
+// output. Called from the audio thread only.
+void audio_reverb_block()
+{
+    audio_Reverb *reverb = &audio_reverb;
+    u32 block = (u32)SDL_AtomicGet(&reverb->blocks);
+    r32 *x = reverb->inputs + (block & (reverb->history - 1))*Audio_Reverb_Spectrum;
+    for (int c = 0; c < Audio_Channels; c++)
+    {
+        r32 *re = x + c*2*Audio_Reverb_Bins;
+        fft_real(&reverb->plan, reverb->frames + c, Audio_Channels, re, re + Audio_Reverb_Bins);
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&reverb->blocks, (int)(block + 1));
+    SDL_SemPost(reverb->wake);
+
+    int slot = (int)(block % Audio_Reverb_Slots);
+    if ((u32)SDL_AtomicGet(&reverb->tail_block[slot]) == block)
+    {
+        SDL_MemoryBarrierAcquire();
+        SDL_memcpy(reverb->sum, reverb->tails + slot*Audio_Reverb_Spectrum, sizeof(reverb->sum));
+    }
+    else
+    {
+        // The first blocks have no tail yet
+        SDL_memset(reverb->sum, 0, sizeof(reverb->sum));
+        if (block >= Audio_Reverb_Head)
+            SDL_AtomicAdd(&reverb->late, 1);
+    }
+    audio_reverb_sum(reverb->sum, block, 0, Audio_Reverb_Head);
+
+    for (int c = 0; c < Audio_Channels; c++)
+    {
+        r32 *re = reverb->sum + c*2*Audio_Reverb_Bins;
+        fft_real_inverse(&reverb->plan, re, re + Audio_Reverb_Bins, reverb->time, 1);
+        for (int i = 0; i < Audio_Reverb_Block; i++)
+            reverb->wet[i*Audio_Channels + c] = reverb->time[Audio_Reverb_Block + i];
+    }
+    SDL_memcpy(reverb->frames, reverb->frames + Audio_Reverb_Block*Audio_Channels,
+               Audio_Reverb_Block*Audio_Channels*sizeof(r32));
+}
+
+// Sends _send_ times the mix to the reverb and adds what comes
+// back. Called from the audio thread only.
+void audio_reverb_mix(audio_MixSample *mix, int frames, r32 send)
+{
+    audio_Reverb *reverb = &audio_reverb;
+    SDL_MemoryBarrierAcquire();
+    r32 scale = Audio_Mix_Scale*send;
+    int done = 0;
+    while (done < frames)
+    {
+        int count = SDL_min(frames - done, Audio_Reverb_Block - reverb->fill);
+        r32 *input = reverb->frames + (Audio_Reverb_Block + reverb->fill)*Audio_Channels;
+        r32 *wet = reverb->wet + reverb->fill*Audio_Channels;
+        audio_MixSample *at = mix + done*Audio_Channels;
+        for (int i = 0; i < count*Audio_Channels; i++)
+        {
+            input[i] = scale*(r32)at[i];
+            at[i] += (audio_MixSample)(wet[i] / Audio_Mix_Scale);
+        }
+        reverb->fill += count;
+        done += count;
+        if (reverb->fill == Audio_Reverb_Block)
+        {
+            audio_reverb_block();
+            reverb->fill = 0;
+        }
+    }
+}
+
+// Starts the reverb with _impulse_ as its impulse response, mono
+// or stereo, at Audio_Sample_Rate and at most
+// Audio_Max_Reverb_Seconds long. A mono response is used for both
+// channels. The source is only read here, so it can be freed
+// afterwards. Nothing goes through the reverb until
+// audio_reverb_send. Called once, from the game thread.
+bool audio_start_reverb(audio_Source impulse)
+{
+    audio_Reverb *reverb = &audio_reverb;
+    Assert(!reverb->thread);
+    int channels = impulse.channels;
+    int frames = impulse.buffer ? impulse.length / channels : 0;
+    if (frames == 0 || impulse.decoder || frames > Audio_Max_Reverb_Seconds*Audio_Sample_Rate)
+    {
+        Printf("The impulse response must be in memory and at most %d seconds long\n",
+               Audio_Max_Reverb_Seconds);
+        return false;
+    }
+    if (!fft_create(&reverb->plan, 2*Audio_Reverb_Block))
+        return false;
+
+    reverb->partitions = (frames + Audio_Reverb_Block - 1) / Audio_Reverb_Block;
+    reverb->history = 1;
+    while (reverb->history < reverb->partitions + Audio_Reverb_Head)
+        reverb->history *= 2;
+    reverb->impulse = (r32*)SDL_calloc(reverb->partitions, Audio_Reverb_Spectrum*sizeof(r32));
+    reverb->inputs = (r32*)SDL_calloc(reverb->history, Audio_Reverb_Spectrum*sizeof(r32));
+    reverb->tails = (r32*)SDL_calloc(Audio_Reverb_Slots, Audio_Reverb_Spectrum*sizeof(r32));
+
+    // Each partition is padded with a block of zeros. The scale also
+    // undoes the gain of the inverse FFT.
+    r32 scale = 1.0f / (2.0f*Audio_Reverb_Block*Audio_Value_Max);
+    for (int p = 0; p < reverb->partitions; p++)
+    {
+        for (int c = 0; c < Audio_Channels; c++)
+        {
+            SDL_memset(reverb->time, 0, sizeof(reverb->time));
+            for (int i = 0; i < Audio_Reverb_Block && p*Audio_Reverb_Block + i < frames; i++)
+            {
+                int frame = p*Audio_Reverb_Block + i;
+                reverb->time[i] = scale*impulse.buffer[frame*channels + (channels == 1 ? 0 : c)];
+            }
+            r32 *re = reverb->impulse + p*Audio_Reverb_Spectrum + c*2*Audio_Reverb_Bins;
+            fft_real(&reverb->plan, reverb->time, 1, re, re + Audio_Reverb_Bins);
+        }
+    }
+
+    for (int i = 0; i < Audio_Reverb_Slots; i++)
+        SDL_AtomicSet(&reverb->tail_block[i], -1);
+    SDL_AtomicSet(&reverb->blocks, 0);
+    SDL_AtomicSet(&reverb->late, 0);
+    reverb->fill = 0;
+    reverb->wake = SDL_CreateSemaphore(0);
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&reverb->running, 1);
+    reverb->thread = SDL_CreateThread(audio_reverb_thread, "audio_reverb", 0);
+    return true;
+}
+
+// A run is a contiguous piece of a source that is mixed into
+// the output buffer in one go, without checking the stream state
+// for every frame.
+struct audio_Run
+{
+    int offset;   // First output frame to write to
+    int position; // First source sample to read from
+    int frames;   // Number of frames in the run
+};
+
+#define Audio_Max_Runs 64
+
+// Splits the output frames from _first_ up to _frames_to_fill_
+// into runs for the given stream, wrapping around at the end of
+// the source if the stream repeats. The stream is advanced past
+// the planned frames, and is paused if it reaches the end. At
+// most max_runs runs are planned; if the returned runs do not
+// reach frames_to_fill (a very short repeating source), call
+// again from where the last run ended.
+int audio_plan_runs(audio_Stream *stream,
+                    int first,
+                    int frames_to_fill,
+                    audio_Run *runs,
+                    int max_runs)
+{
+    int position = stream->position;
+    int remaining = stream->remaining;
+    int length = stream->source.length;
+    int loop_start = stream->source.loop_start;
+    int channels = stream->source.channels;
+    int offset = first;
+    int num_runs = 0;
+    while (offset < frames_to_fill && num_runs < max_runs)
+    {
+        if (remaining < channels)
+        {
+            if (!stream->repeat || length - loop_start < channels)
+            {
+                stream->paused = 1;
+                break;
+            }
+            position = loop_start;
+            remaining = length - loop_start;
+        }
+
+        int frames = remaining / channels;
+        if (frames > frames_to_fill - offset)
+            frames = frames_to_fill - offset;
+
+        runs[num_runs].offset = offset;
+        runs[num_runs].position = position;
+        runs[num_runs].frames = frames;
+        num_runs++;
+
+        offset += frames;
+        position += frames*channels;
+        remaining -= frames*channels;
+    }
+    stream->position = position;
+    stream->remaining = remaining;
+    return num_runs;
+}
+
+// Like audio_plan_runs, for a stream that plays from a decoder.
+// The runs cover what the decode thread has written so far, so
+// if it falls behind the rest of the buffer is left silent. The
+// runs must be mixed before audio_release_decoder hands the ring
+// back to the decode thread.
+int audio_plan_decoder_runs(audio_Stream *stream,
+                            int first,
+                            int frames_to_fill,
+                            audio_Run *runs,
+                            int max_runs)
+{
+    audio_Decoder *decoder = stream->source.decoder;
+    int channels = stream->source.channels;
+
+    // The decode thread only writes samples from a seek after it
+    // has published _seek_done_, so if that did not change while
+    // we looked, _write_ and _seek_at_ belong together.
+    int done;
+    bool finished;
+    u32 write;
+    u32 seek_at;
+    do
+    {
+        done = SDL_AtomicGet(&decoder->seek_done);
+        SDL_MemoryBarrierAcquire();
+        finished = SDL_AtomicGet(&decoder->finished) != 0;
+        SDL_MemoryBarrierAcquire();
+        write = (u32)SDL_AtomicGet(&decoder->write);
+        seek_at = (u32)SDL_AtomicGet(&decoder->seek_at);
+        SDL_MemoryBarrierAcquire();
+    } while (SDL_AtomicGet(&decoder->seek_done) != done);
+
+    u32 read = decoder->consumed;
+    bool seeking = false;
+    int request = SDL_AtomicGet(&decoder->seek_request);
+    if (decoder->seek_applied != request)
+    {
+        if (done == request && (finished || write - seek_at >= Audio_Seek_Preroll_Samples))
+        {
+            // A seek that failed goes on from where the decoder was,
+            // so play through what is buffered instead of jumping.
+            int reached = SDL_AtomicGet(&decoder->seek_reached);
+            if (reached == SDL_AtomicGet(&decoder->seek_frame))
+                read = seek_at;
+            stream->position = reached*channels - (int)(seek_at - read);
+            if (stream->position < 0)
+                stream->position = 0;
+            decoder->seek_applied = request;
+        }
+        else
+        {
+            // Play out what came before the seek, but not the pre-roll
+            if ((s32)(seek_at - read) > 0)
+                write = seek_at;
+            seeking = true;
+        }
+    }
+
+    int offset = first;
+    int num_runs = 0;
+    while (offset < frames_to_fill && num_runs < max_runs && read != write)
+    {
+        u32 index = read % Audio_Decoder_Ring_Samples;
+        int frames = (int)(write - read) / channels;
+        int to_end = (Audio_Decoder_Ring_Samples - (int)index) / channels;
+        if (frames > to_end)
+            frames = to_end;
+        if (frames > frames_to_fill - offset)
+            frames = frames_to_fill - offset;
+
+        runs[num_runs].offset = offset;
+        runs[num_runs].position = (int)index;
+        runs[num_runs].frames = frames;
+        num_runs++;
+
+        offset += frames;
+        read += frames*channels;
+        if (!seeking)
+            stream->position += frames*channels;
+        if (stream->repeat && decoder->length > 0)
+            stream->position %= decoder->length;
+    }
+    decoder->consumed = read;
+    if (read == write && finished && !seeking)
+        stream->paused = 1;
+    return num_runs;
+}
+
+// Lets the decode thread reuse the part of the ring that has
+// been mixed.
+void audio_release_decoder(audio_Decoder *decoder)
+{
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&decoder->read, (int)decoder->consumed);
+}
+
+// Advances a stream that plays at another rate by _frames_ output
+// frames, wrapping into the loop or pausing at the end.
+void audio_advance_pitched(audio_Stream *stream, int frames)
+{
+    int channels = stream->source.channels;
+    u64 end = (u64)(stream->source.length / channels);
+    u64 loop_start = (u64)(stream->source.loop_start / channels);
+    u64 loop_length = end - loop_start;
+    u64 position = ((u64)(stream->position / channels) << 32) | stream->phase;
+    position += stream->rate*(u64)frames;
+    u64 frame = position >> 32;
+    if (frame >= end)
+    {
+        if (stream->repeat && loop_length > 0)
+        {
+            frame = loop_start + (frame - end) % loop_length;
+        }
+        else
+        {
+            frame = end;
+            position = 0;
+            stream->paused = 1;
+        }
+    }
+    stream->position = (int)frame*channels;
+    stream->remaining = stream->source.length - stream->position;
+    stream->phase = (u32)position;
+}
+
+// Mixes a stream that plays at another rate into _output_, which
+// is always r32 and stereo. Used for sources held in memory only.
+void audio_mix_pitched(audio_Stream *stream, r32 *output, int frames,
+                       r32 gain_l, r32 gain_r, r32 step_l, r32 step_r)
+{
+    // Source frames from Audio_Sinc_Taps/2 - 1 before the first
+    // to Audio_Sinc_Taps/2 after the last one read
+    #define PITCH_BEFORE (Audio_Sinc_Taps/2 - 1)
+    static r32 scratch[(Audio_Max_Rate*2048 + 2*Audio_Sinc_Taps)*Audio_Channels];
+    Assert(frames <= 2048);
+
+    audio_Source source = stream->source;
+    int channels = source.channels;
+    int end = source.length / channels;
+    int loop_start = source.loop_start / channels;
+    int loop_length = end - loop_start;
+    bool loops = stream->repeat && loop_length > 0;
+    u64 position = ((u64)(stream->position / channels) << 32) | stream->phase;
+
+    // Without a loop, stop at the first output frame past the end
+    if (!loops)
+    {
+        u64 left = ((u64)end << 32) - position;
+        u64 limit = (left + stream->rate - 1) / stream->rate;
+        if (limit < (u64)frames)
+            frames = (int)limit;
+    }
+
+    if (frames > 0)
+    {
+        int first = (int)(position >> 32) - PITCH_BEFORE;
+        int last = (int)((position + stream->rate*(u64)(frames - 1)) >> 32) + Audio_Sinc_Taps/2;
+        // Copied in pieces that are each silence or a contiguous
+        // part of the source
+        r32 *to = scratch;
+        r32 scale = 1.0f / Audio_Value_Max;
+        for (int frame = first; frame <= last;)
+        {
+            int at = frame;
+            if (at >= end && loops)
+                at = loop_start + (at - end) % loop_length;
+            int count = last - frame + 1;
+            if (at < 0 || at >= end)
+            {
+                if (at < 0 && count > -at)
+                    count = -at;
+                SDL_memset(to, 0, count*Audio_Channels*sizeof(r32));
+            }
+            else
+            {
+                if (count > end - at)
+                    count = end - at;
+                s16 *from = source.buffer + at*channels;
+                if (channels == 1)
+                {
+                    for (int i = 0; i < count; i++)
+                        to[2*i+0] = to[2*i+1] = from[i]*scale;
+                }
+                else
+                {
+                    for (int i = 0; i < 2*count; i++)
+                        to[i] = from[i]*scale;
+                }
+            }
+            frame += count;
+            to += count*Audio_Channels;
+        }
+        audio_mix_pitch[stream->interpolation](output, scratch + PITCH_BEFORE*Audio_Channels,
+                                               (u32)position, stream->rate, frames,
+                                               gain_l, gain_r, step_l, step_r);
+    }
+    audio_advance_pitched(stream, frames);
+    #undef PITCH_BEFORE
+}
+
+// Advances a virtual stream by _frames_ without mixing it,
+// following the same wrap and end rules as audio_plan_runs.
+void audio_skip(audio_Stream *stream, int frames)
+{
+    if (stream->source.decoder)
+    {
+        audio_Run runs[Audio_Max_Runs];
+        audio_plan_decoder_runs(stream, 0, frames, runs, Audio_Max_Runs);
+        audio_release_decoder(stream->source.decoder);
+        return;
+    }
+    if (stream->rate != Audio_Unit_Rate)
+    {
+        audio_advance_pitched(stream, frames);
+        return;
+    }
+
+    int channels = stream->source.channels;
+    int advance = frames*channels;
+    int loop_start = stream->source.loop_start;
+    int loop_length = stream->source.length - loop_start;
+    if (advance < stream->remaining)
+    {
+        stream->position += advance;
+        stream->remaining -= advance;
+    }
+    else if (stream->repeat && loop_length >= channels)
+    {
+        advance = (advance - stream->remaining) % loop_length;
+        stream->position = loop_start + advance;
+        stream->remaining = loop_length - advance;
+    }
+    else
+    {
+        stream->position += stream->remaining;
+        stream->remaining = 0;
+        stream->paused = 1;
+    }
+}
+
+struct audio_Voice
+{
+    r32 audibility;
+    audio_id id;
+};
+
+// Partially sorts voices so that the n most audible ones come
+// first, in no particular order (quickselect).
+void audio_select_audible(audio_Voice *voices, int count, int n)
+{
+    int lo = 0;
+    int hi = count - 1;
+    while (lo < hi)
+    {
+        r32 pivot = voices[(lo + hi) / 2].audibility;
+        int i = lo;
+        int j = hi;
+        while (i <= j)
+        {
+            while (voices[i].audibility > pivot) i++;
+            while (voices[j].audibility < pivot) j--;
+            if (i <= j)
+            {
+                audio_Voice temp = voices[i];
+                voices[i] = voices[j];
+                voices[j] = temp;
+                i++;
+                j--;
+            }
+        }
+        if (n - 1 <= j)
+            hi = j;
+        else if (n - 1 >= i)
+            lo = i;
+        else
+            break;
+    }
+}
+
+// Marks all but the max_real_voices most audible playing
+// streams as virtual for this callback.
+void audio_virtualize_voices()
+{
+    static audio_Voice voices[Audio_Max_Streams];
+    int count = audio.num_active;
+    int budget = audio.max_real_voices;
+    if (count <= budget)
+    {
+        for (int i = 0; i < count; i++)
+            audio.streams[audio.active_streams[i]].virtualized = 0;
+        audio.num_real = count;
+        return;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        audio_Stream *stream = audio.streams + audio.active_streams[i];
+        r32 gain = stream->gain_l > stream->gain_r ? stream->gain_l : stream->gain_r;
+        voices[i].audibility = gain*stream->source.loudness;
+        voices[i].id = audio.active_streams[i];
+    }
+    audio_select_audible(voices, count, budget);
+    for (int i = 0; i < count; i++)
+        audio.streams[voices[i].id].virtualized = (i >= budget);
+    audio.num_real = budget;
+}
+
+// Filtered streams waiting for the filter kernel, and the buffers
+// they are mixed into. Only touched by the audio thread.
+struct audio_FilterGroup
+{
+    r32 *buffers[Audio_Filter_Group];
+    r32 *inputs[Audio_Filter_Group];
+    audio_Biquad *biquads[Audio_Filter_Group];
+    int count;
+};
+
+// Returns a cleared buffer to mix the stream into before it is
+// filtered. Called from the audio thread only.
+r32 *audio_filter_slot(audio_FilterGroup *group, audio_Stream *stream, int frames)
+{
+    r32 *buffer = group->buffers[group->count];
+    SDL_memset(buffer, 0, frames*Audio_Channels*sizeof(r32));
+    group->inputs[group->count] = buffer;
+    group->biquads[group->count] = &stream->biquad;
+    group->count++;
+    return buffer;
+}
+
+// Filters the streams in the group into _output_ and empties it.
+void audio_filter_group(r32 *output, audio_FilterGroup *group, int frames)
+{
+    static r32 silence[2048*Audio_Channels];
+    static audio_Biquad unused;
+    if (group->count == 0)
+        return;
+    for (int i = group->count; i < Audio_Filter_Group; i++)
+    {
+        group->inputs[i] = silence;
+        group->biquads[i] = &unused;
+    }
+    audio_filter_kernel(output, group->inputs, group->biquads, frames);
+    group->count = 0;
+}
+
+// The callback must completely initialize the buffer; as of SDL 2.0, this
+// buffer is not initialized before the callback is called. If there is
+// nothing to play, the callback should fill the buffer with silence.
+void audio_callback(void *userdata,
+                    u08 *sdl_buffer,
+                    s32 bytes_to_fill)
+{
+    // The number of samples had better be an even multiple of the
+    // number of channels!
+    s32 bytes_per_sample = SDL_AUDIO_BITSIZE(audio.device_format) / 8;
+    Assert(bytes_to_fill % (Audio_Channels*bytes_per_sample) == 0);
+    s32 samples_to_fill = bytes_to_fill / bytes_per_sample;
+
+    #define MIX_BUFFER_SAMPLES (2048*Audio_Channels)
+    Assert(MIX_BUFFER_SAMPLES >= samples_to_fill);
+
+    audio_process_cmds();
+    audio_virtualize_voices();
+
+    // mix sources
+    #if AUDIO_FIXED_POINT
+    static s32 mix_buffer[MIX_BUFFER_SAMPLES];
+    #else
+    // A float device takes the mix as is, so mix straight into it.
+    static r32 mix_storage[MIX_BUFFER_SAMPLES];
+    r32 *mix_buffer = mix_storage;
+    if (audio.device_format == AUDIO_F32SYS)
+        mix_buffer = (r32*)sdl_buffer;
+    #endif
+    SDL_memset(mix_buffer, 0, samples_to_fill*sizeof(mix_buffer[0]));
+
+    // Filtered and pitched streams are mixed in floating point
+    // either way
+    static r32 filter_buffers[Audio_Filter_Group][MIX_BUFFER_SAMPLES];
+    audio_FilterGroup filter_group = {};
+    for (int i = 0; i < Audio_Filter_Group; i++)
+        filter_group.buffers[i] = filter_buffers[i];
+    #if AUDIO_FIXED_POINT
+    static r32 float_mix[MIX_BUFFER_SAMPLES];
+    SDL_memset(float_mix, 0, samples_to_fill*sizeof(r32));
+    #else
+    r32 *float_mix = mix_buffer;
+    #endif
+
+    for (int active_index = 0;
+         active_index < audio.num_active;)
+    {
+        audio_id id = audio.active_streams[active_index];
+        audio_Stream *stream = audio.streams + id;
+
+        audio_Source source = stream->source;
+
+        int frames_to_fill = samples_to_fill / Audio_Channels;
+
+        if (stream->virtualized)
+        {
+            audio_skip(stream, frames_to_fill);
+
+            // fade in when the stream becomes real again
+            stream->mix_gain_l = 0.0f;
+            stream->mix_gain_r = 0.0f;
+            stream->snap_gain = 0;
+            SDL_memset(stream->biquad.z1, 0, sizeof(stream->biquad.z1));
+            SDL_memset(stream->biquad.z2, 0, sizeof(stream->biquad.z2));
+        }
+
+        r32 gain_l = audio.gain_l * stream->gain_l;
+        r32 gain_r = audio.gain_r * stream->gain_r;
+        if (stream->snap_gain)
+        {
+            stream->mix_gain_l = gain_l;
+            stream->mix_gain_r = gain_r;
+            stream->snap_gain = 0;
+        }
+        r32 step_l = (gain_l - stream->mix_gain_l) / frames_to_fill;
+        r32 step_r = (gain_r - stream->mix_gain_r) / frames_to_fill;
+        #if AUDIO_FIXED_POINT
+        s32 fixed_gain_l = audio_gain_to_q30(stream->mix_gain_l);
+        s32 fixed_gain_r = audio_gain_to_q30(stream->mix_gain_r);
+        s32 fixed_step_l = (audio_gain_to_q30(gain_l) - fixed_gain_l) / frames_to_fill;
+        s32 fixed_step_r = (audio_gain_to_q30(gain_r) - fixed_gain_r) / frames_to_fill;
+        #endif
+
+        r32 *filter_input = 0;
+        if (stream->filtered && !stream->paused && !stream->virtualized)
+            filter_input = audio_filter_slot(&filter_group, stream, frames_to_fill);
+
+        if (stream->rate != Audio_Unit_Rate && !source.decoder &&
+            !stream->paused && !stream->virtualized)
+        {
+            audio_mix_pitched(stream, filter_input ? filter_input : float_mix, frames_to_fill,
+                              stream->mix_gain_l, stream->mix_gain_r, step_l, step_r);
+        }
+
+        // Plan the runs for this buffer up front, then mix each
+        // run with a kernel that never looks at the stream state.
+        int frame_index = 0;
+        while (frame_index < frames_to_fill &&
+               stream->rate == Audio_Unit_Rate &&
+               !stream->paused &&
+               !stream->virtualized)
+        {
+            audio_Run runs[Audio_Max_Runs];
+            int num_runs;
+            if (source.decoder)
+                num_runs = audio_plan_decoder_runs(stream, frame_index, frames_to_fill,
+                                                   runs, Audio_Max_Runs);
+            else
+                num_runs = audio_plan_runs(stream, frame_index, frames_to_fill,
+                                           runs, Audio_Max_Runs);
+            for (int r = 0; r < num_runs; r++)
+            {
+                if (filter_input)
+                {
+                    audio_mix[source.channels-1](filter_input + runs[r].offset*Audio_Channels,
+                                                 source.buffer + runs[r].position,
+                                                 runs[r].frames,
+                                                 stream->mix_gain_l + step_l*runs[r].offset,
+                                                 stream->mix_gain_r + step_r*runs[r].offset,
+                                                 step_l, step_r);
+                    continue;
+                }
+                #if AUDIO_FIXED_POINT
+                audio_mix_fixed[source.channels-1](mix_buffer + runs[r].offset*Audio_Channels,
+                                                   source.buffer + runs[r].position,
+                                                   runs[r].frames,
+                                                   fixed_gain_l + fixed_step_l*runs[r].offset,
+                                                   fixed_gain_r + fixed_step_r*runs[r].offset,
+                                                   fixed_step_l, fixed_step_r);
+                #else
+                audio_mix[source.channels-1](mix_buffer + runs[r].offset*Audio_Channels,
+                                             source.buffer + runs[r].position,
+                                             runs[r].frames,
+                                             stream->mix_gain_l + step_l*runs[r].offset,
+                                             stream->mix_gain_r + step_r*runs[r].offset,
+                                             step_l, step_r);
+                #endif
+            }
+            if (num_runs == 0)
+                break;
+            frame_index = runs[num_runs-1].offset + runs[num_runs-1].frames;
+        }
+        if (!stream->virtualized)
+        {
+            stream->mix_gain_l = gain_l;
+            stream->mix_gain_r = gain_r;
+            if (source.decoder)
+                audio_release_decoder(source.decoder);
+        }
+        if (filter_group.count == Audio_Filter_Group)
+            audio_filter_group(float_mix, &filter_group, frames_to_fill);
+
+        // A finished stream is swapped with the last playing
+        // stream, which then needs to be visited at this index.
+        if (stream->paused)
+        {
+            audio_deactivate(id);
+        }
+        else
+        {
+            SDL_AtomicSet(&stream->published_position, stream->position / source.channels);
+            SDL_AtomicSet(&stream->published_playing, 1);
+            active_index++;
+        }
+    }
+
+    audio_filter_group(float_mix, &filter_group, samples_to_fill / Audio_Channels);
+    #if AUDIO_FIXED_POINT
+    for (int i = 0; i < samples_to_fill; i++)
+        mix_buffer[i] += (s32)(float_mix[i]*Audio_Value_Max);
+    #endif
+
+    if (SDL_AtomicGet(&audio_reverb.running))
+        audio_reverb_mix(mix_buffer, samples_to_fill / Audio_Channels, audio.reverb_send);
+
+    if (SDL_AtomicGet(&audio_analyzer.running))
+        audio_tap(mix_buffer, samples_to_fill);
+
+    // write result to output stream
+    #if AUDIO_FIXED_POINT
+    audio_pack((s16*)sdl_buffer, mix_buffer, samples_to_fill);
+    #else
+    if (audio.device_format == AUDIO_S16SYS)
+        audio_convert((s16*)sdl_buffer, mix_buffer, samples_to_fill);
+    #endif
+}
+
+// Opens the audio device and starts it paused. With prefer_float
+// the device is asked for AUDIO_F32 and allowed to pick another
+// format; if it keeps AUDIO_F32SYS the callback writes the mix
+// with no conversion at all. Any format other than AUDIO_F32SYS
+// or AUDIO_S16SYS, and the fixed point mixer, fall back to
+// AUDIO_S16SYS, which SDL converts for us if the device needs it.
+bool audio_open(bool prefer_float)
+{
+    SDL_AudioSpec desired = {};
+    desired.freq = Audio_Sample_Rate;
+    desired.format = Audio_Format;
+    desired.channels = Audio_Channels;
+    desired.samples = Audio_Frame_Size;
+    desired.callback = audio_callback;
+    desired.userdata = 0;
+
+    SDL_AudioSpec obtained = {};
+    #if !AUDIO_FIXED_POINT
+    if (prefer_float)
+    {
+        desired.format = AUDIO_F32SYS;
+        audio.device = SDL_OpenAudioDevice(0, 0, &desired, &obtained,
+                                           SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+        if (audio.device != 0 &&
+            obtained.format != AUDIO_F32SYS &&
+            obtained.format != AUDIO_S16SYS)
+        {
+            SDL_CloseAudioDevice(audio.device);
+            audio.device = 0;
+        }
+    }
+    #endif
+
+    if (audio.device == 0)
+    {
+        desired.format = AUDIO_S16SYS;
+        audio.device = SDL_OpenAudioDevice(0, 0, &desired, &obtained, 0);
+        obtained.format = AUDIO_S16SYS;
+    }
+
+    if (audio.device == 0)
+        return false;
+
+    audio.device_format = obtained.format;
+    Printf("Audio device: %d Hz, %d channels, %d samples, format 0x%x\n",
+           obtained.freq, obtained.channels, obtained.samples,
+           audio.device_format);
+    return true;
+}
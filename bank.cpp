@@ -0,0 +1,189 @@
+#define SDL_ASSERT_LEVEL 2
+#define Assert SDL_assert
+#define Printf SDL_Log
+#include "SDL.h"
+#include "SDL_assert.h"
+#include <stdint.h>
+typedef float       r32;
+typedef uint64_t    u64;
+typedef uint32_t    u32;
+typedef uint16_t    u16;
+typedef uint8_t     u08;
+typedef int32_t     s32;
+typedef int16_t     s16;
+typedef int8_t      s08;
+
+#define ArrayCount(x) (sizeof(x)/sizeof(x[0]))
+
+#include "lib/stb_vorbis.c"
+#include "fft.cpp"
+#include "audio.cpp"
+
+// Packs WAV and Ogg Vorbis files into a sound bank (see audio.cpp).
+//
+//   bank output.bank ../fx1.wav ../fx2.wav ../bgm1.ogg ...
+//
+// Each sound is named by its file name without directory or
+// extension, so the game looks up ../fx1.wav as "fx1". Sounds are
+// converted to the mixer format on the way in. The loop start is
+// taken from the first loop in the WAV smpl chunk, if there is one.
+
+#define Bank_Max_Sounds 4096
+#define Bank_Max_Name 256
+
+// "../sfx/fx1.wav" -> "fx1"
+void bank_sound_name(char *path, char *name)
+{
+    char *start = path;
+    for (char *c = path; *c; c++)
+    {
+        if (*c == '/' || *c == '\\')
+            start = c + 1;
+    }
+    int length = 0;
+    for (char *c = start; *c && *c != '.' && length < Bank_Max_Name - 1; c++)
+        name[length++] = *c;
+    name[length] = 0;
+}
+
+// Returns the start of the first loop of a WAV file, in frames at
+// the file's own rate, or -1 if it has none.
+int bank_wav_loop_start(char *path, int *freq)
+{
+    s32 size = 0;
+    u08 *file = audio_map_file(path, &size);
+    if (!file)
+        return -1;
+
+    int result = -1;
+    SDL_AudioSpec spec;
+    u08 *data;
+    u32 data_size;
+    if (audio_parse_riff(file, size, &spec, &data, &data_size))
+    {
+        *freq = spec.freq;
+        s32 at = 12;
+        while (at + 8 <= size)
+        {
+            u08 *chunk = file + at;
+            u32 chunk_size = audio_read_u32(chunk + 4);
+            if (chunk_size > (u32)(size - at - 8))
+                chunk_size = (u32)(size - at - 8);
+            // 9 u32 fields, then loops of 6 u32 fields: id, type, start, ...
+            if (SDL_memcmp(chunk, "smpl", 4) == 0 && chunk_size >= 36 + 24 &&
+                audio_read_u32(chunk + 8 + 28) > 0)
+            {
+                result = (int)audio_read_u32(chunk + 8 + 36 + 8);
+                break;
+            }
+            at += 8 + chunk_size + (chunk_size & 1);
+        }
+    }
+    audio_unmap_file(file, size);
+    return result;
+}
+
+bool bank_write(char *filename, audio_Source *sources, char (*names)[Bank_Max_Name], int count)
+{
+    u32 table_size = 1;
+    while (table_size < 2*(u32)count)
+        table_size *= 2;
+
+    audio_BankHeader header = {};
+    header.magic = Audio_Bank_Magic;
+    header.version = Audio_Bank_Version;
+    header.num_sounds = count;
+    header.table_size = table_size;
+
+    audio_BankEntry *entries = (audio_BankEntry*)SDL_calloc(table_size, sizeof(audio_BankEntry));
+    u32 offset = (u32)(sizeof(audio_BankHeader) + table_size*sizeof(audio_BankEntry));
+    for (int i = 0; i < count; i++)
+    {
+        u32 hash = audio_bank_hash(names[i]);
+        audio_BankEntry *entry = audio_bank_find(entries, table_size, hash);
+        if (entry->hash != 0)
+        {
+            Printf("%s has the same hash as another sound, rename it\n", names[i]);
+            SDL_free(entries);
+            return false;
+        }
+        offset = (offset + 15) & ~15u;
+        entry->hash = hash;
+        entry->offset = offset;
+        entry->length = sources[i].length;
+        entry->channels = sources[i].channels;
+        entry->loop_start = sources[i].loop_start;
+        entry->loudness = sources[i].loudness;
+        offset += (u32)(sources[i].length*sizeof(s16));
+    }
+
+    SDL_RWops *rw = SDL_RWFromFile(filename, "wb");
+    if (!rw)
+    {
+        Printf("Failed to create %s\n", filename);
+        SDL_free(entries);
+        return false;
+    }
+    SDL_RWwrite(rw, &header, sizeof(header), 1);
+    SDL_RWwrite(rw, entries, sizeof(audio_BankEntry), table_size);
+    u32 written = (u32)(sizeof(audio_BankHeader) + table_size*sizeof(audio_BankEntry));
+    for (int i = 0; i < count; i++)
+    {
+        audio_BankEntry *entry = audio_bank_find(entries, table_size, audio_bank_hash(names[i]));
+        u08 zero[16] = {};
+        SDL_RWwrite(rw, zero, 1, entry->offset - written);
+        SDL_RWwrite(rw, sources[i].buffer, sizeof(s16), sources[i].length);
+        written = entry->offset + (u32)(sources[i].length*sizeof(s16));
+    }
+    SDL_RWclose(rw);
+    SDL_free(entries);
+    Printf("Wrote %s: %d sounds, %u bytes\n", filename, count, written);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        Printf("Usage: bank output.bank sound.wav|sound.ogg ...\n");
+        return 1;
+    }
+
+    int count = argc - 2;
+    if (count > Bank_Max_Sounds)
+    {
+        Printf("At most %d sounds per bank\n", Bank_Max_Sounds);
+        return 1;
+    }
+
+    audio_init();
+
+    static audio_Source sources[Bank_Max_Sounds];
+    static char names[Bank_Max_Sounds][Bank_Max_Name];
+    for (int i = 0; i < count; i++)
+    {
+        char *path = argv[i + 2];
+        bank_sound_name(path, names[i]);
+        if (audio_is_ogg(path))
+        {
+            sources[i] = audio_load_ogg(path);
+        }
+        else
+        {
+            sources[i] = audio_load(path);
+            int freq = Audio_Sample_Rate;
+            int loop_start = bank_wav_loop_start(path, &freq);
+            if (loop_start > 0)
+            {
+                int frame = (int)((u64)loop_start*Audio_Sample_Rate / freq);
+                sources[i].loop_start = frame*sources[i].channels;
+                if (sources[i].loop_start > sources[i].length)
+                    sources[i].loop_start = 0;
+            }
+        }
+        if (!sources[i].buffer)
+            return 1;
+    }
+
+    return bank_write(argv[1], sources, names, count) ? 0 : 1;
+}
@@ -0,0 +1,416 @@
+// Real input FFT, for looking at the spectrum of a signal.
+//
+//   fft_Plan plan;
+//   fft_create(&plan, 4096);
+//   fft_real(&plan, samples, 1, real, imag); // 4096/2 + 1 bins each
+//   fft_destroy(&plan);
+//
+// The n real samples are packed into n/2 complex ones, even samples
+// as the real part and odd as the imaginary part. They go through an
+// n/2 point complex FFT, which is then split into the spectrum of the
+// real signal. The output is not normalized,
+//
+//   X[k] = sum x[j] e^(-2 pi i jk/n), for k = 0 .. n/2
+//
+// fft_real_inverse goes back from the n/2 + 1 bins to n samples,
+// again without normalizing, so the samples come out n times larger.
+//
+// A plan holds its own work buffers, so use one plan per thread.
+
+#include <math.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define FFT_NEON 1
+#include <arm_neon.h>
+#elif defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define FFT_SSE 1
+#include <emmintrin.h>
+#endif
+
+#define Fft_Min_Size 4
+#define Fft_Max_Size 65536
+
+struct fft_Plan
+{
+    int n;    // Number of real input samples, a power of two
+    int half; // n/2, the size of the complex FFT
+
+    // Where each complex input goes before the first pass.
+    u32 *bit_reverse;
+
+    // e^(-pi i j/m) for the radix-2 pass that joins transforms of
+    // size m, at [m + j]. The radix-4 pass needs none.
+    r32 *twiddle_re;
+    r32 *twiddle_im;
+
+    // e^(-2 pi i k/n), to split the complex FFT into the real one.
+    r32 *split_re;
+    r32 *split_im;
+
+    r32 *work_re;
+    r32 *work_im;
+};
+
+// Returns false if n is not a power of two from Fft_Min_Size to
+// Fft_Max_Size.
+bool fft_create(fft_Plan *plan, int n)
+{
+    *plan = fft_Plan();
+    if (n < Fft_Min_Size || n > Fft_Max_Size || (n & (n - 1)) != 0)
+    {
+        Printf("FFT size must be a power of two from %d to %d, not %d\n",
+               Fft_Min_Size, Fft_Max_Size, n);
+        return false;
+    }
+    int half = n/2;
+    int bits = 0;
+    while ((1 << bits) < half)
+        bits++;
+
+    plan->n = n;
+    plan->half = half;
+    plan->bit_reverse = (u32*)SDL_malloc(half*sizeof(u32));
+    plan->twiddle_re = (r32*)SDL_malloc(half*sizeof(r32));
+    plan->twiddle_im = (r32*)SDL_malloc(half*sizeof(r32));
+    plan->split_re = (r32*)SDL_malloc(half*sizeof(r32));
+    plan->split_im = (r32*)SDL_malloc(half*sizeof(r32));
+    plan->work_re = (r32*)SDL_malloc(half*sizeof(r32));
+    plan->work_im = (r32*)SDL_malloc(half*sizeof(r32));
+
+    for (int j = 0; j < half; j++)
+    {
+        u32 reversed = 0;
+        for (int bit = 0; bit < bits; bit++)
+            reversed |= ((j >> bit) & 1) << (bits - 1 - bit);
+        plan->bit_reverse[j] = reversed;
+    }
+
+    // In double, so the large tables are as accurate as the small
+    double pi = 3.14159265358979323846;
+    for (int m = 4; m < half; m *= 2)
+    {
+        for (int j = 0; j < m; j++)
+        {
+            plan->twiddle_re[m + j] = (r32)cos(pi*j/m);
+            plan->twiddle_im[m + j] = (r32)-sin(pi*j/m);
+        }
+    }
+    for (int k = 0; k < half; k++)
+    {
+        plan->split_re[k] = (r32)cos(2.0*pi*k/n);
+        plan->split_im[k] = (r32)-sin(2.0*pi*k/n);
+    }
+    return true;
+}
+
+void fft_destroy(fft_Plan *plan)
+{
+    SDL_free(plan->bit_reverse);
+    SDL_free(plan->twiddle_re);
+    SDL_free(plan->twiddle_im);
+    SDL_free(plan->split_re);
+    SDL_free(plan->split_im);
+    SDL_free(plan->work_re);
+    SDL_free(plan->work_im);
+    *plan = fft_Plan();
+}
+
+// The first two passes of the complex FFT in one: transforms of
+// size 4, whose only twiddle is -i.
+void fft_radix4_pass(r32 *re, r32 *im, int half)
+{
+    for (int i = 0; i < half; i += 4)
+    {
+        r32 a0r = re[i+0] + re[i+1], a0i = im[i+0] + im[i+1];
+        r32 a1r = re[i+0] - re[i+1], a1i = im[i+0] - im[i+1];
+        r32 a2r = re[i+2] + re[i+3], a2i = im[i+2] + im[i+3];
+        r32 a3r = re[i+2] - re[i+3], a3i = im[i+2] - im[i+3];
+        re[i+0] = a0r + a2r; im[i+0] = a0i + a2i;
+        re[i+2] = a0r - a2r; im[i+2] = a0i - a2i;
+        re[i+1] = a1r + a3i; im[i+1] = a1i - a3r;
+        re[i+3] = a1r - a3i; im[i+3] = a1i + a3r;
+    }
+}
+
+// Joins pairs of transforms of size m into transforms of size 2m.
+// m is at least 4, so the vector loops need no tail.
+void fft_radix2_pass(r32 *re, r32 *im, int half, int m, r32 *twiddle_re, r32 *twiddle_im)
+{
+    for (int block = 0; block < half; block += 2*m)
+    {
+        r32 *ar = re + block;
+        r32 *ai = im + block;
+        r32 *br = ar + m;
+        r32 *bi = ai + m;
+        int j = 0;
+        #if defined(FFT_SSE)
+        for (; j < m; j += 4)
+        {
+            __m128 wr = _mm_loadu_ps(twiddle_re + j);
+            __m128 wi = _mm_loadu_ps(twiddle_im + j);
+            __m128 xr = _mm_loadu_ps(br + j);
+            __m128 xi = _mm_loadu_ps(bi + j);
+            __m128 tr = _mm_sub_ps(_mm_mul_ps(wr, xr), _mm_mul_ps(wi, xi));
+            __m128 ti = _mm_add_ps(_mm_mul_ps(wr, xi), _mm_mul_ps(wi, xr));
+            __m128 yr = _mm_loadu_ps(ar + j);
+            __m128 yi = _mm_loadu_ps(ai + j);
+            _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+            _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+            _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+            _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+        }
+        #elif defined(FFT_NEON)
+        for (; j < m; j += 4)
+        {
+            float32x4_t wr = vld1q_f32(twiddle_re + j);
+            float32x4_t wi = vld1q_f32(twiddle_im + j);
+            float32x4_t xr = vld1q_f32(br + j);
+            float32x4_t xi = vld1q_f32(bi + j);
+            float32x4_t tr = vsubq_f32(vmulq_f32(wr, xr), vmulq_f32(wi, xi));
+            float32x4_t ti = vaddq_f32(vmulq_f32(wr, xi), vmulq_f32(wi, xr));
+            float32x4_t yr = vld1q_f32(ar + j);
+            float32x4_t yi = vld1q_f32(ai + j);
+            vst1q_f32(ar + j, vaddq_f32(yr, tr));
+            vst1q_f32(ai + j, vaddq_f32(yi, ti));
+            vst1q_f32(br + j, vsubq_f32(yr, tr));
+            vst1q_f32(bi + j, vsubq_f32(yi, ti));
+        }
+        #endif
+        for (; j < m; j++)
+        {
+            r32 tr = twiddle_re[j]*br[j] - twiddle_im[j]*bi[j];
+            r32 ti = twiddle_re[j]*bi[j] + twiddle_im[j]*br[j];
+            r32 yr = ar[j];
+            r32 yi = ai[j];
+            ar[j] = yr + tr; ai[j] = yi + ti;
+            br[j] = yr - tr; bi[j] = yi - ti;
+        }
+    }
+}
+
+// Splits the complex FFT Z of the packed samples into bins 1 to
+// half-1 of the real FFT X. With E and O the transforms of the even
+// and odd samples, Z[k] = E[k] + i O[k] and X[k] = E[k] + w^k O[k],
+// where E[k] = (Z[k] + conj(Z[half-k]))/2 and
+// O[k] = -i (Z[k] - conj(Z[half-k]))/2.
+void fft_split(fft_Plan *plan, r32 *real, r32 *imag)
+{
+    r32 *re = plan->work_re;
+    r32 *im = plan->work_im;
+    r32 *wr = plan->split_re;
+    r32 *wi = plan->split_im;
+    int half = plan->half;
+    int k = 1;
+    #if defined(FFT_SSE)
+    __m128 one_half = _mm_set1_ps(0.5f);
+    for (; k + 4 <= half; k += 4)
+    {
+        // Z[half-k] for the 4 bins, last one first
+        __m128 cr = _mm_loadu_ps(re + half - k - 3);
+        __m128 ci = _mm_loadu_ps(im + half - k - 3);
+        cr = _mm_shuffle_ps(cr, cr, _MM_SHUFFLE(0, 1, 2, 3));
+        ci = _mm_shuffle_ps(ci, ci, _MM_SHUFFLE(0, 1, 2, 3));
+        __m128 zr = _mm_loadu_ps(re + k);
+        __m128 zi = _mm_loadu_ps(im + k);
+        __m128 er = _mm_mul_ps(one_half, _mm_add_ps(zr, cr));
+        __m128 ei = _mm_mul_ps(one_half, _mm_sub_ps(zi, ci));
+        __m128 dr = _mm_mul_ps(one_half, _mm_sub_ps(zr, cr));
+        __m128 di = _mm_mul_ps(one_half, _mm_add_ps(zi, ci));
+        __m128 w_re = _mm_loadu_ps(wr + k);
+        __m128 w_im = _mm_loadu_ps(wi + k);
+        _mm_storeu_ps(real + k, _mm_add_ps(er, _mm_add_ps(_mm_mul_ps(w_re, di), _mm_mul_ps(w_im, dr))));
+        _mm_storeu_ps(imag + k, _mm_add_ps(ei, _mm_sub_ps(_mm_mul_ps(w_im, di), _mm_mul_ps(w_re, dr))));
+    }
+    #elif defined(FFT_NEON)
+    float32x4_t one_half = vdupq_n_f32(0.5f);
+    for (; k + 4 <= half; k += 4)
+    {
+        float32x4_t cr = vrev64q_f32(vld1q_f32(re + half - k - 3));
+        float32x4_t ci = vrev64q_f32(vld1q_f32(im + half - k - 3));
+        cr = vcombine_f32(vget_high_f32(cr), vget_low_f32(cr));
+        ci = vcombine_f32(vget_high_f32(ci), vget_low_f32(ci));
+        float32x4_t zr = vld1q_f32(re + k);
+        float32x4_t zi = vld1q_f32(im + k);
+        float32x4_t er = vmulq_f32(one_half, vaddq_f32(zr, cr));
+        float32x4_t ei = vmulq_f32(one_half, vsubq_f32(zi, ci));
+        float32x4_t dr = vmulq_f32(one_half, vsubq_f32(zr, cr));
+        float32x4_t di = vmulq_f32(one_half, vaddq_f32(zi, ci));
+        float32x4_t w_re = vld1q_f32(wr + k);
+        float32x4_t w_im = vld1q_f32(wi + k);
+        vst1q_f32(real + k, vaddq_f32(er, vaddq_f32(vmulq_f32(w_re, di), vmulq_f32(w_im, dr))));
+        vst1q_f32(imag + k, vaddq_f32(ei, vsubq_f32(vmulq_f32(w_im, di), vmulq_f32(w_re, dr))));
+    }
+    #endif
+    for (; k < half; k++)
+    {
+        r32 er = 0.5f*(re[k] + re[half - k]);
+        r32 ei = 0.5f*(im[k] - im[half - k]);
+        r32 dr = 0.5f*(re[k] - re[half - k]);
+        r32 di = 0.5f*(im[k] + im[half - k]);
+        real[k] = er + (wr[k]*di + wi[k]*dr);
+        imag[k] = ei + (wi[k]*di - wr[k]*dr);
+    }
+}
+
+// Transforms plan->n samples, read _stride_ apart, into n/2 + 1
+// bins of real and imaginary parts.
+void fft_real(fft_Plan *plan, r32 *input, int stride, r32 *real, r32 *imag)
+{
+    r32 *re = plan->work_re;
+    r32 *im = plan->work_im;
+    int half = plan->half;
+    for (int j = 0; j < half; j++)
+    {
+        u32 to = plan->bit_reverse[j];
+        re[to] = input[(2*j + 0)*stride];
+        im[to] = input[(2*j + 1)*stride];
+    }
+
+    if (half >= 4)
+    {
+        fft_radix4_pass(re, im, half);
+        for (int m = 4; m < half; m *= 2)
+            fft_radix2_pass(re, im, half, m, plan->twiddle_re + m, plan->twiddle_im + m);
+    }
+    else
+    {
+        r32 r = re[0], i = im[0];
+        re[0] = r + re[1]; im[0] = i + im[1];
+        re[1] = r - re[1]; im[1] = i - im[1];
+    }
+
+    // Z[half] wraps around to Z[0], and the imaginary parts of the
+    // first and last bins cancel
+    real[0] = re[0] + im[0];
+    imag[0] = 0.0f;
+    real[half] = re[0] - im[0];
+    imag[half] = 0.0f;
+    fft_split(plan, real, imag);
+}
+
+// Transforms n/2 + 1 bins of a real signal back into plan->n
+// samples, written _stride_ apart, times n. The imaginary parts of
+// the first and last bins are ignored. Runs fft_split backwards:
+// Z[k] = 2 (E[k] + i O[k]) is built from the bins, and its inverse
+// complex FFT is taken as the swapped FFT of the swapped Z, which
+// gives the even samples in the real parts and the odd ones in
+// the imaginary parts.
+void fft_real_inverse(fft_Plan *plan, r32 *real, r32 *imag, r32 *output, int stride)
+{
+    r32 *re = plan->work_re;
+    r32 *im = plan->work_im;
+    r32 *wr = plan->split_re;
+    r32 *wi = plan->split_im;
+    int half = plan->half;
+    for (int k = 0; k < half; k++)
+    {
+        // X[k] and conj(X[half-k]), with imag[0] and imag[half] as 0
+        r32 ar = real[k];
+        r32 ai = k > 0 ? imag[k] : 0.0f;
+        r32 br = real[half - k];
+        r32 bi = k > 0 ? -imag[half - k] : 0.0f;
+        r32 er = ar + br, ei = ai + bi;
+        r32 dr = ar - br, di = ai - bi;
+        r32 or_ = dr*wr[k] + di*wi[k];
+        r32 oi = di*wr[k] - dr*wi[k];
+        u32 to = plan->bit_reverse[k];
+        re[to] = ei + or_;
+        im[to] = er - oi;
+    }
+
+    if (half >= 4)
+    {
+        fft_radix4_pass(re, im, half);
+        for (int m = 4; m < half; m *= 2)
+            fft_radix2_pass(re, im, half, m, plan->twiddle_re + m, plan->twiddle_im + m);
+    }
+    else
+    {
+        r32 r = re[0], i = im[0];
+        re[0] = r + re[1]; im[0] = i + im[1];
+        re[1] = r - re[1]; im[1] = i - im[1];
+    }
+
+    for (int j = 0; j < half; j++)
+    {
+        output[(2*j + 0)*stride] = im[j];
+        output[(2*j + 1)*stride] = re[j];
+    }
+}
+
+// Transforms each of _channels_ interleaved signals of plan->n
+// samples. The bins of channel c start at real + c*(n/2 + 1).
+void fft_real_batch(fft_Plan *plan, r32 *input, int channels, r32 *real, r32 *imag)
+{
+    int bins = plan->half + 1;
+    for (int c = 0; c < channels; c++)
+        fft_real(plan, input + c, channels, real + c*bins, imag + c*bins);
+}
+
+// Returns the largest error of an n point FFT of noise against a
+// direct DFT in double, relative to the largest bin, or of the
+// noise after fft_real_inverse relative to the largest sample if
+// that is worse. This is quadratic in n, so only check sizes of a
+// few thousand.
+r32 fft_check(int n)
+{
+    fft_Plan plan;
+    if (!fft_create(&plan, n))
+        return 1.0f;
+    int bins = n/2 + 1;
+    r32 *input = (r32*)SDL_malloc(n*sizeof(r32));
+    r32 *real = (r32*)SDL_malloc(bins*sizeof(r32));
+    r32 *imag = (r32*)SDL_malloc(bins*sizeof(r32));
+    double *cosine = (double*)SDL_malloc(n*sizeof(double));
+    double *sine = (double*)SDL_malloc(n*sizeof(double));
+    u32 seed = 12345;
+    for (int j = 0; j < n; j++)
+    {
+        seed = seed*1664525 + 1013904223;
+        input[j] = (r32)((seed >> 16) & 0xffff) / 32768.0f - 1.0f;
+        cosine[j] = cos(2.0*3.14159265358979323846*j/n);
+        sine[j] = sin(2.0*3.14159265358979323846*j/n);
+    }
+    fft_real(&plan, input, 1, real, imag);
+
+    double error = 0.0;
+    double largest = 0.0;
+    for (int k = 0; k < bins; k++)
+    {
+        double sum_re = 0.0, sum_im = 0.0;
+        for (int j = 0; j < n; j++)
+        {
+            int phase = (int)(((u64)j*k) % n);
+            sum_re += input[j]*cosine[phase];
+            sum_im -= input[j]*sine[phase];
+        }
+        double d = sqrt((real[k] - sum_re)*(real[k] - sum_re) + (imag[k] - sum_im)*(imag[k] - sum_im));
+        double m = sqrt(sum_re*sum_re + sum_im*sum_im);
+        if (d > error) error = d;
+        if (m > largest) largest = m;
+    }
+    error /= largest;
+
+    r32 *inverse = (r32*)SDL_malloc(n*sizeof(r32));
+    fft_real_inverse(&plan, real, imag, inverse, 1);
+    double inverse_error = 0.0;
+    double largest_sample = 0.0;
+    for (int j = 0; j < n; j++)
+    {
+        double d = fabs(inverse[j] / n - input[j]);
+        if (d > inverse_error) inverse_error = d;
+        if (fabs(input[j]) > largest_sample) largest_sample = fabs(input[j]);
+    }
+    inverse_error /= largest_sample;
+    if (inverse_error > error)
+        error = inverse_error;
+
+    SDL_free(inverse);
+    SDL_free(input);
+    SDL_free(real);
+    SDL_free(imag);
+    SDL_free(cosine);
+    SDL_free(sine);
+    fft_destroy(&plan);
+    return (r32)error;
+}
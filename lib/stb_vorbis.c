@@ -129,6 +129,36 @@ extern stb_vorbis_info stb_vorbis_get_info(stb_vorbis *f);
 // get the last error detected (clears it, too)
 extern int stb_vorbis_get_error(stb_vorbis *f);
 
+// SHARED SETUP
+//
+// the headers of an Ogg Vorbis stream (codebooks, floor, residue, mapping
+// and mode configs) and the IMDCT tables derived from them make up most of
+// a decoder's memory and most of the time it takes to open. when several
+// decoders play the same stream, they can share one read-only copy.
+
+typedef struct stb_vorbis_setup stb_vorbis_setup;
+
+extern stb_vorbis_setup *stb_vorbis_get_setup(stb_vorbis *f);
+// returns the setup of f, with a reference for the caller. f must have
+// been opened without an alloc_buffer, since the setup can outlive it.
+// returns NULL on failure. a seek table that f has built is shared too.
+
+extern void stb_vorbis_release_setup(stb_vorbis_setup *s);
+// drops a reference; the setup is freed when neither the caller nor any
+// decoder opened with it holds one. safe to call from any thread.
+
+extern stb_vorbis * stb_vorbis_open_memory_with_setup(const unsigned char *data, int len,
+                                  stb_vorbis_setup *s, int *error, stb_vorbis_alloc *alloc_buffer);
+// like stb_vorbis_open_memory(), for the same stream that s came from.
+// only the decode buffers are allocated, so an alloc_buffer can be much
+// smaller. the decoder holds a reference to s until it is closed.
+
+// when decoding from an alloc_buffer, returns the most of it that has been
+// in use at once so far, setup and temp memory together. after decoding a
+// whole file this is the exact alloc_buffer size the file needs (more, if
+// you also build a seek table). returns 0 without an alloc_buffer.
+extern int stb_vorbis_get_alloc_high_water(stb_vorbis *f);
+
 // close an ogg vorbis file and free all memory in use
 extern void stb_vorbis_close(stb_vorbis *f);
 
@@ -260,6 +290,10 @@ extern stb_vorbis * stb_vorbis_open_file_section(FILE *f, int close_handle_on_cl
 // on failure, returns NULL and sets *error. note that stb_vorbis must "own"
 // this stream; if you seek it in between calls to stb_vorbis, it will become
 // confused.
+
+extern stb_vorbis * stb_vorbis_open_filename_with_setup(const char *filename,
+                                  stb_vorbis_setup *s, int *error, stb_vorbis_alloc *alloc_buffer);
+// like stb_vorbis_open_filename(), see stb_vorbis_open_memory_with_setup()
 #endif
 
 extern int stb_vorbis_seek_frame(stb_vorbis *f, unsigned int sample_number);
@@ -274,6 +308,33 @@ extern int stb_vorbis_seek(stb_vorbis *f, unsigned int sample_number);
 extern void stb_vorbis_seek_start(stb_vorbis *f);
 // this function is equivalent to stb_vorbis_seek(f,0)
 
+extern int stb_vorbis_build_seek_table(stb_vorbis *f);
+// reads the header of every page in the file once and keeps a table of
+// page offsets by sample number, so that later seeks find their page with
+// one lookup instead of probing the file. returns the number of pages in
+// the table, or 0 on failure (seeking then falls back to the search). the
+// table is freed by stb_vorbis_close().
+
+enum STBVorbisSimd
+{
+   STB_VORBIS_SIMD_NONE = 0,
+   STB_VORBIS_SIMD_SSE2,
+   STB_VORBIS_SIMD_AVX2,
+   STB_VORBIS_SIMD_NEON
+};
+
+extern int stb_vorbis_set_simd(int simd);
+// selects the kernels for the IMDCT butterflies and the overlap-add, for
+// all decoders. the caller checks that the CPU supports them. asking for
+// kernels that were not compiled in (see STB_VORBIS_NO_SIMD) selects the
+// scalar ones. returns the kernels now in use. must not be called while
+// anything is decoding.
+
+extern float stb_vorbis_check_simd(void);
+// runs an IMDCT and an overlap-add of noise through both the selected and
+// the scalar kernels, and returns the largest difference in the output
+// relative to the largest output value.
+
 extern unsigned int stb_vorbis_stream_length_in_samples(stb_vorbis *f);
 extern float        stb_vorbis_stream_length_in_seconds(stb_vorbis *f);
 // these functions return the total length of the vorbis stream
@@ -514,6 +575,11 @@ enum STBVorbisError
 //     you'd ever want to do it except for debugging.
 // #define STB_VORBIS_NO_DEFER_FLOOR
 
+// STB_VORBIS_NO_SIMD
+//     leaves out the SSE2, AVX2 and NEON kernels for the IMDCT and the
+//     overlap-add, so stb_vorbis_set_simd() can only select scalar ones.
+// #define STB_VORBIS_NO_SIMD
+
 
 
 
@@ -749,10 +815,20 @@ struct stb_vorbis
 
    ProbedPage p_first, p_last;
 
+   // pages with a known last sample, in file order (see
+   // stb_vorbis_build_seek_table)
+   ProbedPage *seek_table;
+   int seek_table_len;
+
+   // headers and IMDCT tables shared with other decoders, or NULL if
+   // this decoder owns its own (see stb_vorbis_get_setup)
+   stb_vorbis_setup *setup;
+
   // memory management
    stb_vorbis_alloc alloc;
    int setup_offset;
    int temp_offset;
+   int alloc_high_water;
 
   // run-time results
    int eof;
@@ -775,6 +851,7 @@ struct stb_vorbis
    Mapping *mapping;
    int mode_count;
    Mode mode_config[64];  // varies
+   int longest_floorlist;
 
    uint32 total_samples;
 
@@ -889,6 +966,13 @@ static void *make_block_array(void *mem, int count, int size)
    return p;
 }
 
+static void note_alloc_high_water(vorb *f)
+{
+   int used = f->setup_offset + f->alloc.alloc_buffer_length_in_bytes - f->temp_offset;
+   if (used > f->alloc_high_water)
+      f->alloc_high_water = used;
+}
+
 static void *setup_malloc(vorb *f, int sz)
 {
    sz = (sz+3) & ~3;
@@ -897,6 +981,7 @@ static void *setup_malloc(vorb *f, int sz)
       void *p = (char *) f->alloc.alloc_buffer + f->setup_offset;
       if (f->setup_offset + sz > f->temp_offset) return NULL;
       f->setup_offset += sz;
+      note_alloc_high_water(f);
       return p;
    }
    return sz ? malloc(sz) : NULL;
@@ -914,6 +999,7 @@ static void *setup_temp_malloc(vorb *f, int sz)
    if (f->alloc.alloc_buffer) {
       if (f->temp_offset - sz < f->setup_offset) return NULL;
       f->temp_offset -= sz;
+      note_alloc_high_water(f);
       return (char *) f->alloc.alloc_buffer + f->temp_offset;
    }
    return malloc(sz);
@@ -1237,6 +1323,23 @@ static int init_blocksize(vorb *f, int b, int n)
    return TRUE;
 }
 
+// the buffers each decoder needs for itself, even with a shared setup
+static int init_channel_buffers(vorb *f)
+{
+   int i;
+   for (i=0; i < f->channels; ++i) {
+      f->channel_buffers[i] = (float *) setup_malloc(f, sizeof(float) * f->blocksize_1);
+      f->previous_window[i] = (float *) setup_malloc(f, sizeof(float) * f->blocksize_1/2);
+      f->finalY[i]          = (int16 *) setup_malloc(f, sizeof(int16) * f->longest_floorlist);
+      if (f->channel_buffers[i] == NULL || f->previous_window[i] == NULL || f->finalY[i] == NULL) return error(f, VORBIS_outofmem);
+      #ifdef STB_VORBIS_NO_DEFER_FLOOR
+      f->floor_buffers[i]   = (float *) setup_malloc(f, sizeof(float) * f->blocksize_1/2);
+      if (f->floor_buffers[i] == NULL) return error(f, VORBIS_outofmem);
+      #endif
+   }
+   return TRUE;
+}
+
 static void neighbors(uint16 *x, int n, int *plow, int *phigh)
 {
    int low = -1;
@@ -2449,6 +2552,199 @@ void inverse_mdct(float *buffer, int n, vorb *f, int blocktype)
 #endif
 
 
+// SIMD kernels
+//
+// Iterations 0 to ld-7 of step 3 all do the same butterfly: four pairs
+// e0[-2j],e0[-2j-1] and e2[-2j],e2[-2j-1] become their sum and their
+// difference rotated by the twiddle at A + a_pair*j. The loops differ only
+// in how far A and e move after each group of four, so one kernel per
+// instruction set covers them. The kernels do the same multiplies and adds
+// as the scalar loops, so the output matches up to how the compiler orders
+// them. NULL selects the scalar loops.
+
+typedef void imdct_butterfly_kernel(float *e0, float *e2, float *A, int a_pair, int a_step, int e_step, int count);
+
+// out[j] = out[j]*w[j] + prev[j]*w[n-1-j]
+typedef void overlap_add_kernel(float *out, float *prev, float *w, int n);
+
+static void overlap_add_scalar(float *out, float *prev, float *w, int n)
+{
+   int j;
+   for (j=0; j < n; ++j)
+      out[j] = out[j]*w[j] + prev[j]*w[n-1-j];
+}
+
+static imdct_butterfly_kernel *imdct_butterfly;
+static overlap_add_kernel *overlap_add = overlap_add_scalar;
+static int simd_selected = STB_VORBIS_SIMD_NONE;
+
+#ifndef STB_VORBIS_NO_SIMD
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+   #define STB_VORBIS_NEON
+   #include <arm_neon.h>
+#elif defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+   #define STB_VORBIS_SSE2
+   #include <emmintrin.h>
+   #include <immintrin.h>
+   #ifdef _MSC_VER
+      #define STB_VORBIS_TARGET_AVX2
+   #else
+      #define STB_VORBIS_TARGET_AVX2 __attribute__((target("avx2")))
+   #endif
+#endif
+#endif
+
+#ifdef STB_VORBIS_SSE2
+// two pairs at e0[-3..0]; t holds their twiddles as A0,A1 of the pair at
+// e0[-3] then A0,A1 of the pair at e0[-1]
+static __forceinline void butterfly2_sse2(float *e0, float *e2, __m128 t)
+{
+   __m128 sign = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+   __m128 x0 = _mm_loadu_ps(e0);
+   __m128 x2 = _mm_loadu_ps(e2);
+   __m128 k  = _mm_sub_ps(x0, x2);
+   __m128 ks = _mm_shuffle_ps(k, k, _MM_SHUFFLE(2,3,0,1));
+   __m128 c  = _mm_shuffle_ps(t, t, _MM_SHUFFLE(2,2,0,0));
+   __m128 s  = _mm_mul_ps(_mm_shuffle_ps(t, t, _MM_SHUFFLE(3,3,1,1)), sign);
+   _mm_storeu_ps(e0, _mm_add_ps(x0, x2));
+   _mm_storeu_ps(e2, _mm_add_ps(_mm_mul_ps(k, c), _mm_mul_ps(ks, s)));
+}
+
+static void imdct_butterfly_sse2(float *e0, float *e2, float *A, int a_pair, int a_step, int e_step, int count)
+{
+   int i;
+   for (i=count; i > 0; --i) {
+      __m128 t01 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (A + a_pair)), (__m64 *) A);
+      __m128 t23 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (A + a_pair*3)), (__m64 *) (A + a_pair*2));
+      butterfly2_sse2(e0-3, e2-3, t01);
+      butterfly2_sse2(e0-7, e2-7, t23);
+      A += a_step;
+      e0 -= e_step;
+      e2 -= e_step;
+   }
+}
+
+static void overlap_add_sse2(float *out, float *prev, float *w, int n)
+{
+   int j;
+   for (j=0; j+4 <= n; j += 4) {
+      __m128 wr = _mm_loadu_ps(w + n-4-j);
+      wr = _mm_shuffle_ps(wr, wr, _MM_SHUFFLE(0,1,2,3));
+      _mm_storeu_ps(out+j, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(out+j), _mm_loadu_ps(w+j)),
+                                      _mm_mul_ps(_mm_loadu_ps(prev+j), wr)));
+   }
+   for (; j < n; ++j)
+      out[j] = out[j]*w[j] + prev[j]*w[n-1-j];
+}
+
+// all four pairs at once
+STB_VORBIS_TARGET_AVX2
+static void imdct_butterfly_avx2(float *e0, float *e2, float *A, int a_pair, int a_step, int e_step, int count)
+{
+   __m256 sign = _mm256_setr_ps(1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f);
+   int i;
+   for (i=count; i > 0; --i) {
+      __m128 t01 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (A + a_pair)), (__m64 *) A);
+      __m128 t23 = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), (__m64 *) (A + a_pair*3)), (__m64 *) (A + a_pair*2));
+      __m256 t  = _mm256_insertf128_ps(_mm256_castps128_ps256(t23), t01, 1);
+      __m256 x0 = _mm256_loadu_ps(e0-7);
+      __m256 x2 = _mm256_loadu_ps(e2-7);
+      __m256 k  = _mm256_sub_ps(x0, x2);
+      __m256 ks = _mm256_shuffle_ps(k, k, _MM_SHUFFLE(2,3,0,1));
+      __m256 c  = _mm256_shuffle_ps(t, t, _MM_SHUFFLE(2,2,0,0));
+      __m256 s  = _mm256_mul_ps(_mm256_shuffle_ps(t, t, _MM_SHUFFLE(3,3,1,1)), sign);
+      _mm256_storeu_ps(e0-7, _mm256_add_ps(x0, x2));
+      _mm256_storeu_ps(e2-7, _mm256_add_ps(_mm256_mul_ps(k, c), _mm256_mul_ps(ks, s)));
+      A += a_step;
+      e0 -= e_step;
+      e2 -= e_step;
+   }
+}
+
+STB_VORBIS_TARGET_AVX2
+static void overlap_add_avx2(float *out, float *prev, float *w, int n)
+{
+   int j;
+   for (j=0; j+8 <= n; j += 8) {
+      __m256 wr = _mm256_loadu_ps(w + n-8-j);
+      wr = _mm256_permute_ps(wr, _MM_SHUFFLE(0,1,2,3));
+      wr = _mm256_permute2f128_ps(wr, wr, 1);
+      _mm256_storeu_ps(out+j, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(out+j), _mm256_loadu_ps(w+j)),
+                                            _mm256_mul_ps(_mm256_loadu_ps(prev+j), wr)));
+   }
+   for (; j < n; ++j)
+      out[j] = out[j]*w[j] + prev[j]*w[n-1-j];
+}
+#endif
+
+#ifdef STB_VORBIS_NEON
+static __forceinline void butterfly2_neon(float *e0, float *e2, float32x4_t t)
+{
+   static const float sign[4] = { 1.0f, -1.0f, 1.0f, -1.0f };
+   float32x4_t x0 = vld1q_f32(e0);
+   float32x4_t x2 = vld1q_f32(e2);
+   float32x4_t k  = vsubq_f32(x0, x2);
+   float32x4x2_t cs = vtrnq_f32(t, t);
+   float32x4_t s  = vmulq_f32(cs.val[1], vld1q_f32(sign));
+   vst1q_f32(e0, vaddq_f32(x0, x2));
+   vst1q_f32(e2, vaddq_f32(vmulq_f32(k, cs.val[0]), vmulq_f32(vrev64q_f32(k), s)));
+}
+
+static void imdct_butterfly_neon(float *e0, float *e2, float *A, int a_pair, int a_step, int e_step, int count)
+{
+   int i;
+   for (i=count; i > 0; --i) {
+      float32x4_t t01 = vcombine_f32(vld1_f32(A + a_pair), vld1_f32(A));
+      float32x4_t t23 = vcombine_f32(vld1_f32(A + a_pair*3), vld1_f32(A + a_pair*2));
+      butterfly2_neon(e0-3, e2-3, t01);
+      butterfly2_neon(e0-7, e2-7, t23);
+      A += a_step;
+      e0 -= e_step;
+      e2 -= e_step;
+   }
+}
+
+static void overlap_add_neon(float *out, float *prev, float *w, int n)
+{
+   int j;
+   for (j=0; j+4 <= n; j += 4) {
+      float32x4_t wr = vrev64q_f32(vld1q_f32(w + n-4-j));
+      wr = vcombine_f32(vget_high_f32(wr), vget_low_f32(wr));
+      vst1q_f32(out+j, vaddq_f32(vmulq_f32(vld1q_f32(out+j), vld1q_f32(w+j)),
+                                 vmulq_f32(vld1q_f32(prev+j), wr)));
+   }
+   for (; j < n; ++j)
+      out[j] = out[j]*w[j] + prev[j]*w[n-1-j];
+}
+#endif
+
+int stb_vorbis_set_simd(int simd)
+{
+   imdct_butterfly = NULL;
+   overlap_add = overlap_add_scalar;
+   simd_selected = STB_VORBIS_SIMD_NONE;
+   #ifdef STB_VORBIS_SSE2
+   if (simd == STB_VORBIS_SIMD_SSE2) {
+      imdct_butterfly = imdct_butterfly_sse2;
+      overlap_add = overlap_add_sse2;
+      simd_selected = simd;
+   }
+   if (simd == STB_VORBIS_SIMD_AVX2) {
+      imdct_butterfly = imdct_butterfly_avx2;
+      overlap_add = overlap_add_avx2;
+      simd_selected = simd;
+   }
+   #endif
+   #ifdef STB_VORBIS_NEON
+   if (simd == STB_VORBIS_SIMD_NEON) {
+      imdct_butterfly = imdct_butterfly_neon;
+      overlap_add = overlap_add_neon;
+      simd_selected = simd;
+   }
+   #endif
+   return simd_selected;
+}
+
 // the following were split out into separate functions while optimizing;
 // they could be pushed back up but eh. __forceinline showed no change;
 // they're probably already being inlined.
@@ -2459,6 +2755,10 @@ static void imdct_step3_iter0_loop(int n, float *e, int i_off, int k_off, float
    int i;
 
    assert((n & 3) == 0);
+   if (imdct_butterfly) {
+      imdct_butterfly(ee0, ee2, A, 8, 32, 8, n >> 2);
+      return;
+   }
    for (i=(n>>2); i > 0; --i) {
       float k00_20, k01_21;
       k00_20  = ee0[ 0] - ee2[ 0];
@@ -2505,6 +2805,11 @@ static void imdct_step3_inner_r_loop(int lim, float *e, int d0, int k_off, float
    float *e0 = e + d0;
    float *e2 = e0 + k_off;
 
+   if (imdct_butterfly) {
+      imdct_butterfly(e0, e2, A, k1, k1*4, 8, lim >> 2);
+      return;
+   }
+
    for (i=lim >> 2; i > 0; --i) {
       k00_20 = e0[-0] - e2[-0];
       k01_21 = e0[-1] - e2[-1];
@@ -2564,6 +2869,11 @@ static void imdct_step3_inner_s_loop(int n, float *e, int i_off, int k_off, floa
    float *ee0 = e  +i_off;
    float *ee2 = ee0+k_off;
 
+   if (imdct_butterfly) {
+      imdct_butterfly(ee0, ee2, A, a_off, 0, k0, n);
+      return;
+   }
+
    for (i=n; i > 0; --i) {
       k00     = ee0[ 0] - ee2[ 0];
       k11     = ee0[-1] - ee2[-1];
@@ -3503,14 +3813,10 @@ static int vorbis_finish_frame(stb_vorbis *f, int len, int left, int right)
 
    // mixin from previous window
    if (f->previous_length) {
-      int i,j, n = f->previous_length;
+      int i, n = f->previous_length;
       float *w = get_window(f, n);
-      for (i=0; i < f->channels; ++i) {
-         for (j=0; j < n; ++j)
-            f->channel_buffers[i][left+j] =
-               f->channel_buffers[i][left+j]*w[    j] +
-               f->previous_window[i][     j]*w[n-1-j];
-      }
+      for (i=0; i < f->channels; ++i)
+         overlap_add(f->channel_buffers[i]+left, f->previous_window[i], w, n);
    }
 
    prev = f->previous_length;
@@ -4093,16 +4399,8 @@ static int start_decoder(vorb *f)
 
    f->previous_length = 0;
 
-   for (i=0; i < f->channels; ++i) {
-      f->channel_buffers[i] = (float *) setup_malloc(f, sizeof(float) * f->blocksize_1);
-      f->previous_window[i] = (float *) setup_malloc(f, sizeof(float) * f->blocksize_1/2);
-      f->finalY[i]          = (int16 *) setup_malloc(f, sizeof(int16) * longest_floorlist);
-      if (f->channel_buffers[i] == NULL || f->previous_window[i] == NULL || f->finalY[i] == NULL) return error(f, VORBIS_outofmem);
-      #ifdef STB_VORBIS_NO_DEFER_FLOOR
-      f->floor_buffers[i]   = (float *) setup_malloc(f, sizeof(float) * f->blocksize_1/2);
-      if (f->floor_buffers[i] == NULL) return error(f, VORBIS_outofmem);
-      #endif
-   }
+   f->longest_floorlist = longest_floorlist;
+   if (!init_channel_buffers(f)) return FALSE;
 
    if (!init_blocksize(f, 0, f->blocksize_0)) return FALSE;
    if (!init_blocksize(f, 1, f->blocksize_1)) return FALSE;
@@ -4155,9 +4453,79 @@ static int start_decoder(vorb *f)
    return TRUE;
 }
 
-static void vorbis_deinit(stb_vorbis *p)
+struct stb_vorbis_setup
+{
+   volatile long refcount;
+   stb_vorbis shared; // only the header fields and their allocations
+};
+
+#if defined(_MSC_VER)
+   #include <intrin.h>
+   #define setup_add_ref(s, n)  _InterlockedExchangeAdd(&(s)->refcount, (n))
+#else
+   #define setup_add_ref(s, n)  __sync_fetch_and_add(&(s)->refcount, (n))
+#endif
+
+// the same as start_decoder, taking the headers from a setup instead of
+// parsing them
+static int start_decoder_with_setup(vorb *f, stb_vorbis_setup *s)
+{
+   vorb *g = &s->shared;
+   f->sample_rate = g->sample_rate;
+   f->channels = g->channels;
+   f->setup_memory_required = g->setup_memory_required;
+   f->temp_memory_required = g->temp_memory_required;
+   f->setup_temp_memory_required = g->setup_temp_memory_required;
+   f->first_audio_page_offset = g->first_audio_page_offset;
+   f->total_samples = g->total_samples;
+   f->p_last = g->p_last;
+   f->seek_table = g->seek_table;
+   f->seek_table_len = g->seek_table_len;
+   f->blocksize[0] = g->blocksize[0];
+   f->blocksize[1] = g->blocksize[1];
+   f->blocksize_0 = g->blocksize_0;
+   f->blocksize_1 = g->blocksize_1;
+   f->codebook_count = g->codebook_count;
+   f->codebooks = g->codebooks;
+   f->floor_count = g->floor_count;
+   memcpy(f->floor_types, g->floor_types, sizeof(f->floor_types));
+   f->floor_config = g->floor_config;
+   f->residue_count = g->residue_count;
+   memcpy(f->residue_types, g->residue_types, sizeof(f->residue_types));
+   f->residue_config = g->residue_config;
+   f->mapping_count = g->mapping_count;
+   f->mapping = g->mapping;
+   f->mode_count = g->mode_count;
+   memcpy(f->mode_config, g->mode_config, sizeof(f->mode_config));
+   f->longest_floorlist = g->longest_floorlist;
+   memcpy(f->A, g->A, sizeof(f->A));
+   memcpy(f->B, g->B, sizeof(f->B));
+   memcpy(f->C, g->C, sizeof(f->C));
+   memcpy(f->window, g->window, sizeof(f->window));
+   memcpy(f->bit_reverse, g->bit_reverse, sizeof(f->bit_reverse));
+   f->serial = g->serial;
+   f->setup = s;
+   setup_add_ref(s, 1);
+
+   if (!init_channel_buffers(f)) return FALSE;
+   if (f->alloc.alloc_buffer) {
+      if (f->setup_offset + sizeof(*f) + f->temp_memory_required > (unsigned) f->temp_offset)
+         return error(f, VORBIS_outofmem);
+   }
+
+   // the open functions pump the first frame from here
+   if (!set_file_offset(f, f->first_audio_page_offset)) return error(f, VORBIS_unexpected_eof);
+   f->previous_length = 0;
+   f->first_decode = TRUE;
+   f->next_seg = -1;
+   return TRUE;
+}
+
+// frees what stb_vorbis_get_setup shares
+static void free_setup_data(stb_vorbis *p)
 {
    int i,j;
+   setup_free(p, p->seek_table);
    if (p->residue_config) {
       for (i=0; i < p->residue_count; ++i) {
          Residue *r = p->residue_config+i;
@@ -4189,6 +4557,18 @@ static void vorbis_deinit(stb_vorbis *p)
          setup_free(p, p->mapping[i].chan);
       setup_free(p, p->mapping);
    }
+   for (i=0; i < 2; ++i) {
+      setup_free(p, p->A[i]);
+      setup_free(p, p->B[i]);
+      setup_free(p, p->C[i]);
+      setup_free(p, p->window[i]);
+      setup_free(p, p->bit_reverse[i]);
+   }
+}
+
+static void vorbis_deinit(stb_vorbis *p)
+{
+   int i;
    for (i=0; i < p->channels && i < STB_VORBIS_MAX_CHANNELS; ++i) {
       setup_free(p, p->channel_buffers[i]);
       setup_free(p, p->previous_window[i]);
@@ -4197,12 +4577,13 @@ static void vorbis_deinit(stb_vorbis *p)
       #endif
       setup_free(p, p->finalY[i]);
    }
-   for (i=0; i < 2; ++i) {
-      setup_free(p, p->A[i]);
-      setup_free(p, p->B[i]);
-      setup_free(p, p->C[i]);
-      setup_free(p, p->window[i]);
-      setup_free(p, p->bit_reverse[i]);
+   if (p->setup) {
+      // a seek table built after opening is our own
+      if (p->seek_table != p->setup->shared.seek_table)
+         setup_free(p, p->seek_table);
+      stb_vorbis_release_setup(p->setup);
+   } else {
+      free_setup_data(p);
    }
    #ifndef STB_VORBIS_NO_STDIO
    if (p->close_on_free) fclose(p->f);
@@ -4216,6 +4597,86 @@ void stb_vorbis_close(stb_vorbis *p)
    setup_free(p,p);
 }
 
+stb_vorbis_setup *stb_vorbis_get_setup(stb_vorbis *f)
+{
+   stb_vorbis_setup *s;
+   if (f->setup) {
+      setup_add_ref(f->setup, 1);
+      return f->setup;
+   }
+   // the setup is freed with free(), not into f's buffer
+   if (f->alloc.alloc_buffer) { error(f, VORBIS_invalid_api_mixing); return NULL; }
+   s = (stb_vorbis_setup *) malloc(sizeof(*s));
+   if (s == NULL) { error(f, VORBIS_outofmem); return NULL; }
+   s->refcount = 2; // the caller's and f's
+   s->shared = *f;
+   memset(s->shared.channel_buffers, 0, sizeof(s->shared.channel_buffers));
+   memset(s->shared.previous_window, 0, sizeof(s->shared.previous_window));
+   memset(s->shared.finalY, 0, sizeof(s->shared.finalY));
+   #ifdef STB_VORBIS_NO_DEFER_FLOOR
+   memset(s->shared.floor_buffers, 0, sizeof(s->shared.floor_buffers));
+   #endif
+   #ifndef STB_VORBIS_NO_STDIO
+   s->shared.f = NULL;
+   s->shared.close_on_free = FALSE;
+   #endif
+   s->shared.stream = s->shared.stream_start = s->shared.stream_end = NULL;
+   s->shared.setup = NULL;
+   f->setup = s;
+   return s;
+}
+
+void stb_vorbis_release_setup(stb_vorbis_setup *s)
+{
+   if (s == NULL) return;
+   if (setup_add_ref(s, -1) == 1) {
+      free_setup_data(&s->shared);
+      free(s);
+   }
+}
+
+float stb_vorbis_check_simd(void)
+{
+   static float in[2048], expect[2048], result[2048], prev[1024];
+   imdct_butterfly_kernel *butterfly = imdct_butterfly;
+   overlap_add_kernel *add = overlap_add;
+   stb_vorbis f;
+   float peak = 0, worst = 0;
+   uint32 seed = 12345;
+   int b, i, n;
+
+   memset(&f, 0, sizeof(f));
+   if (!init_blocksize(&f, 0, 256) || !init_blocksize(&f, 1, 2048)) {
+      vorbis_deinit(&f);
+      return 1;
+   }
+   for (i=0; i < 2048; ++i) {
+      seed = seed*1664525 + 1013904223;
+      in[i] = (int) (seed >> 16) / 32768.0f - 1.0f;
+   }
+   for (b=0; b < 2; ++b) {
+      n = b ? 2048 : 256;
+      for (i=0; i < 2; ++i) {
+         float *out = i ? result : expect;
+         memcpy(out, in, n * sizeof(*out));
+         memcpy(prev, in + n/2, n/2 * sizeof(*prev));
+         imdct_butterfly = i ? butterfly : NULL;
+         overlap_add = i ? add : overlap_add_scalar;
+         inverse_mdct(out, n, &f, b);
+         overlap_add(out, prev, f.window[b], n/2);
+      }
+      for (i=0; i < n; ++i) {
+         float d = (float) fabs(expect[i] - result[i]);
+         if (fabs(expect[i]) > peak) peak = (float) fabs(expect[i]);
+         if (d > worst) worst = d;
+      }
+   }
+   imdct_butterfly = butterfly;
+   overlap_add = add;
+   vorbis_deinit(&f);
+   return peak > 0 ? worst / peak : worst;
+}
+
 static void vorbis_init(stb_vorbis *p, stb_vorbis_alloc *z)
 {
    memset(p, 0, sizeof(*p)); // NULL out all malloc'd pointers to start
@@ -4243,6 +4704,11 @@ int stb_vorbis_get_sample_offset(stb_vorbis *f)
       return -1;
 }
 
+int stb_vorbis_get_alloc_high_water(stb_vorbis *f)
+{
+   return f->alloc_high_water;
+}
+
 stb_vorbis_info stb_vorbis_get_info(stb_vorbis *f)
 {
    stb_vorbis_info d;
@@ -4650,6 +5116,25 @@ static int seek_to_sample_coarse(stb_vorbis *f, uint32 sample_number)
    else
       sample_number -= padding;
 
+   if (f->seek_table_len > 0) {
+      // the last page that ends at or before the sample, by bisecting the
+      // table in memory; this is the page the search below converges on
+      int lo = 0, hi = f->seek_table_len - 1;
+      if (sample_number <= f->seek_table[0].last_decoded_sample) {
+         stb_vorbis_seek_start(f);
+         return 1;
+      }
+      while (lo < hi) {
+         int m = (lo + hi + 1) >> 1;
+         if (f->seek_table[m].last_decoded_sample <= sample_number)
+            lo = m;
+         else
+            hi = m - 1;
+      }
+      left = f->seek_table[lo];
+      goto found_page;
+   }
+
    left = f->p_first;
    while (left.last_decoded_sample == ~0U) {
       // (untested) the first page does not have a 'last_decoded_sample'
@@ -4725,6 +5210,7 @@ static int seek_to_sample_coarse(stb_vorbis *f, uint32 sample_number)
       ++probe;
    }
 
+found_page:
    // seek back to start of the last packet
    page_start = left.page_start;
    set_file_offset(f, page_start);
@@ -4855,6 +5341,47 @@ int stb_vorbis_seek(stb_vorbis *f, unsigned int sample_number)
    return 1;
 }
 
+int stb_vorbis_build_seek_table(stb_vorbis *f)
+{
+   ProbedPage page;
+   unsigned int restore_offset;
+   int pass, count = 0;
+
+   if (IS_PUSH_MODE(f)) return error(f, VORBIS_invalid_api_mixing);
+   if (f->seek_table) return f->seek_table_len;
+   if (stb_vorbis_stream_length_in_samples(f) == 0) return 0;
+
+   // count the pages, then allocate and fill in the table
+   restore_offset = stb_vorbis_get_file_offset(f);
+   for (pass=0; pass < 2; ++pass) {
+      count = 0;
+      set_file_offset(f, f->first_audio_page_offset);
+      while (get_seek_page_info(f, &page) && !f->eof) {
+         if (page.last_decoded_sample != ~0U) {
+            if (pass == 1 && count < f->seek_table_len)
+               f->seek_table[count] = page;
+            ++count;
+         }
+         if (page.page_end >= f->p_last.page_end) break;
+         set_file_offset(f, page.page_end);
+      }
+      if (pass == 0) {
+         if (count == 0) break;
+         f->seek_table = (ProbedPage *) setup_malloc(f, sizeof(*f->seek_table) * count);
+         if (f->seek_table == NULL) { count = 0; break; }
+         f->seek_table_len = count;
+      }
+   }
+   if (f->seek_table && count != f->seek_table_len) {
+      // the file changed under us or ended early; don't trust the table
+      setup_free(f, f->seek_table);
+      f->seek_table = NULL;
+      f->seek_table_len = count = 0;
+   }
+   set_file_offset(f, restore_offset);
+   return count;
+}
+
 void stb_vorbis_seek_start(stb_vorbis *f)
 {
    if (IS_PUSH_MODE(f)) { error(f, VORBIS_invalid_api_mixing); return; }
@@ -5010,6 +5537,36 @@ stb_vorbis * stb_vorbis_open_filename(const char *filename, int *error, stb_vorb
    if (error) *error = VORBIS_file_open_failure;
    return NULL;
 }
+
+stb_vorbis * stb_vorbis_open_filename_with_setup(const char *filename, stb_vorbis_setup *s, int *error, stb_vorbis_alloc *alloc)
+{
+   stb_vorbis *f, p;
+   FILE *file;
+   if (s == NULL) return NULL;
+   file = fopen(filename, "rb");
+   if (!file) {
+      if (error) *error = VORBIS_file_open_failure;
+      return NULL;
+   }
+   vorbis_init(&p, alloc);
+   p.f = file;
+   p.f_start = 0;
+   fseek(file, 0, SEEK_END);
+   p.stream_len = ftell(file);
+   fseek(file, 0, SEEK_SET);
+   p.close_on_free = TRUE;
+   if (start_decoder_with_setup(&p, s)) {
+      f = vorbis_alloc(&p);
+      if (f) {
+         *f = p;
+         vorbis_pump_first_frame(f);
+         return f;
+      }
+   }
+   if (error) *error = p.error;
+   vorbis_deinit(&p);
+   return NULL;
+}
 #endif // STB_VORBIS_NO_STDIO
 
 stb_vorbis * stb_vorbis_open_memory(const unsigned char *data, int len, int *error, stb_vorbis_alloc *alloc)
@@ -5035,6 +5592,29 @@ stb_vorbis * stb_vorbis_open_memory(const unsigned char *data, int len, int *err
    return NULL;
 }
 
+stb_vorbis * stb_vorbis_open_memory_with_setup(const unsigned char *data, int len, stb_vorbis_setup *s, int *error, stb_vorbis_alloc *alloc)
+{
+   stb_vorbis *f, p;
+   if (data == NULL || s == NULL) return NULL;
+   vorbis_init(&p, alloc);
+   p.stream = (uint8 *) data;
+   p.stream_end = (uint8 *) data + len;
+   p.stream_start = (uint8 *) p.stream;
+   p.stream_len = len;
+   p.push_mode = FALSE;
+   if (start_decoder_with_setup(&p, s)) {
+      f = vorbis_alloc(&p);
+      if (f) {
+         *f = p;
+         vorbis_pump_first_frame(f);
+         return f;
+      }
+   }
+   if (error) *error = p.error;
+   vorbis_deinit(&p);
+   return NULL;
+}
+
 #ifndef STB_VORBIS_NO_INTEGER_CONVERSION
 #define PLAYBACK_MONO     1
 #define PLAYBACK_LEFT     2
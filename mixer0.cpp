@@ -20,6 +20,7 @@ typedef int8_t      s08;
 #define TWO_PI (6.28318530718f)
 
 #include "lib/stb_vorbis.c"
+#include "fft.cpp"
 
 u64 get_tick()
 {
@@ -186,7 +187,8 @@ void audio_lowpass(s16 *input, s16 *result, u32 samples)
 #define DFT_Samples 64
 #define DFT_Sample_To_Hz(k) (Source_Sample_Rate*k/(r32)(DFT_Samples*2))
 // Note: The DFT is symmetric, so we only compute half of the spectrum
-void audio_dft_mono(s16 *mono, r32 *real, r32 *complex, u32 samples)
+// This is the direct DFT, kept to check audio_dft against.
+void audio_dft_mono_reference(s16 *mono, r32 *real, r32 *complex, u32 samples)
 {
     u32 K = DFT_Samples*2;
     for (u32 k = 0; k < DFT_Samples; k++)
@@ -213,8 +215,74 @@ void audio_dft(s16 *stereo,
                r32 *complex_right,
                u32 samples)
 {
-    audio_dft_mono(stereo, real_left, complex_left, samples);
-    audio_dft_mono(stereo+1, real_right, complex_right, samples);
+    u32 K = DFT_Samples*2;
+    static fft_Plan plan;
+    if (!plan.n)
+        fft_create(&plan, K);
+
+    // Every K samples the basis functions repeat, so the K bins of
+    // the whole signal are those of the signal wrapped around onto
+    // K samples.
+    static r32 wrapped[DFT_Samples*2*Source_Channels];
+    SDL_memset(wrapped, 0, sizeof(wrapped));
+    for (u32 n = 0; n < samples; n++)
+    {
+        wrapped[2*(n % K) + 0] += source_s16_to_r32(stereo[2*n + 0]);
+        wrapped[2*(n % K) + 1] += source_s16_to_r32(stereo[2*n + 1]);
+    }
+
+    static r32 real[(DFT_Samples + 1)*Source_Channels];
+    static r32 imag[(DFT_Samples + 1)*Source_Channels];
+    fft_real_batch(&plan, wrapped, Source_Channels, real, imag);
+    r32 scale = 1.0f / sqrt((r32)K);
+    for (u32 k = 0; k < DFT_Samples; k++)
+    {
+        real_left[k] = scale*real[k];
+        complex_left[k] = scale*imag[k];
+        real_right[k] = scale*real[DFT_Samples + 1 + k];
+        complex_right[k] = scale*imag[DFT_Samples + 1 + k];
+    }
+}
+
+// Define as 1 to check the DFT at startup. Off by default, since
+// the reference is slow and an assert must not stop the game.
+#ifndef DFT_CHECK
+#define DFT_CHECK 0
+#endif
+
+// Runs audio_dft against the direct DFT on a noise buffer, and the
+// FFT against a direct DFT in double at each size up to 4096. The
+// float error of an FFT grows with log2(n), to about 5e-7 at 4096,
+// so the bound leaves room for the compiler to reorder the math.
+void audio_check_dft()
+{
+    // Short, since the reference loses precision in the phase
+    // of long buffers
+    #define CHECK_SAMPLES (DFT_Samples*2 + 37)
+    static s16 noise[CHECK_SAMPLES*Source_Channels];
+    static r32 expect[4][DFT_Samples];
+    static r32 result[4][DFT_Samples];
+    u32 seed = 12345;
+    for (u32 i = 0; i < ArrayCount(noise); i++)
+    {
+        seed = seed*1664525 + 1013904223;
+        noise[i] = (s16)(seed >> 16);
+    }
+    audio_dft_mono_reference(noise, expect[0], expect[2], CHECK_SAMPLES);
+    audio_dft_mono_reference(noise+1, expect[1], expect[3], CHECK_SAMPLES);
+    audio_dft(noise, result[0], result[1], result[2], result[3], CHECK_SAMPLES);
+    r32 error = 0.0f;
+    for (u32 i = 0; i < 4; i++)
+    {
+        for (u32 k = 0; k < DFT_Samples; k++)
+            error = SDL_max(error, (r32)fabs(expect[i][k] - result[i][k]));
+    }
+    Printf("DFT check: largest error %g\n", error);
+    Assert(error < 1e-4f);
+
+    for (int n = Fft_Min_Size; n <= 4096; n *= 2)
+        Assert(fft_check(n) < 1e-5f);
+    #undef CHECK_SAMPLES
 }
 
 void audio_callback(void *userdata, u08 *stream, s32 bytes_to_fill)
@@ -294,6 +362,10 @@ int main(int argc, char **argv)
 
     Source src = make_source(square_wave, ArrayCount(square_wave));
 
+    #if DFT_CHECK
+    audio_check_dft();
+    #endif
+
     static r32 real_left[DFT_Samples];
     static r32 real_right[DFT_Samples];
     static r32 complex_left[DFT_Samples];
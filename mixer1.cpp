@@ -290,10 +290,24 @@ r32 source_s16_to_r32(s16 x)
     return result;
 }
 
+// Mixes _frames_ stereo frames from input into the mixing buffer.
+// The caller splits the source into runs, so there is no state
+// to check per frame.
+void source_mix(r32 *output, s16 *input, s32 frames,
+                r32 gain_l, r32 gain_r)
+{
+    for (s32 i = 0; i < frames; i++)
+    {
+        output[2*i+0] += gain_l * source_s16_to_r32(input[2*i+0]);
+        output[2*i+1] += gain_r * source_s16_to_r32(input[2*i+1]);
+    }
+}
+
 enum audio_CmdType
 {
     AUDIO_PLAY = 0,
-    AUDIO_STOP
+    AUDIO_STOP,
+    AUDIO_SEEK
 };
 
 enum audio_Flags {
@@ -307,6 +321,7 @@ struct AudioCmd
     Source *ref;
     audio_CmdType type;
     audio_Flags flags;
+    s32 frame; // AUDIO_SEEK
 };
 
 #define AUDIO_MAX_PLAYING 16
@@ -365,9 +380,20 @@ void audio_StopSource(Audio *audio,
     }
 }
 
-void audio_SeekSource(Audio *audio, Source *source)
+// Moves the source to the given frame (sample per channel).
+// Unlike play and stop this works whether or not it is playing.
+void audio_SeekSource(Audio *audio, Source *source, s32 frame)
 {
-    // TODO: Add cmd
+    if (audio->num_cmds < AUDIO_MAX_CMDS)
+    {
+        AudioCmd cmd = {};
+        cmd.ref = source;
+        cmd.type = AUDIO_SEEK;
+        cmd.flags = AUDIO_NOFLAGS;
+        cmd.frame = frame;
+        audio->cmds[audio->num_cmds] = cmd;
+        audio->num_cmds++;
+    }
 }
 
 void audio_SetGain(Source *source, r32 gain_l, r32 gain_r)
@@ -440,6 +466,17 @@ void audio_callback(void *userdata, u08 *stream, s32 bytes_to_fill)
                     audio->num_playing--;
                 }
             } break;
+
+            case AUDIO_SEEK:
+            {
+                s32 frame = cmd.frame;
+                if (frame < 0)
+                    frame = 0;
+                if (frame > (s32)cmd.ref->samples_per_channel)
+                    frame = (s32)cmd.ref->samples_per_channel;
+                cmd.ref->position = frame*Source_Channels;
+                cmd.ref->remaining = (s32)cmd.ref->samples_in_total - cmd.ref->position;
+            } break;
         }
     }
     audio->num_cmds = 0;
@@ -456,28 +493,28 @@ void audio_callback(void *userdata, u08 *stream, s32 bytes_to_fill)
             continue;
         r32 gain_l = source->gain_l;
         r32 gain_r = source->gain_r;
-        for (s32 sample_index = 0;
-             sample_index < samples_to_fill;
-             sample_index += 2)
+        // Mix the source in runs that end either at the end of
+        // the output buffer or at the end of the source.
+        s32 frames_to_fill = samples_to_fill / Source_Channels;
+        s32 frame_index = 0;
+        while (frame_index < frames_to_fill)
         {
-            if (source->remaining > 0)
-            {
-                s16 xs16_l, xs16_r;
-                r32 xr32_l, xr32_r;
+            s32 frames = source->remaining / Source_Channels;
+            if (frames > frames_to_fill - frame_index)
+                frames = frames_to_fill - frame_index;
 
-                xs16_l = source->buffer[source->position];
-                xs16_r = source->buffer[source->position+1];
+            source_mix(mix_buffer + frame_index*Source_Channels,
+                       source->buffer + source->position,
+                       frames, gain_l, gain_r);
 
-                xr32_l = source_s16_to_r32(xs16_l);
-                xr32_r = source_s16_to_r32(xs16_r);
+            frame_index += frames;
+            source->position += frames*Source_Channels;
+            source->remaining -= frames*Source_Channels;
 
-                mix_buffer[sample_index] += gain_l * xr32_l;
-                mix_buffer[sample_index+1] += gain_r * xr32_r;
+            if (frame_index == frames_to_fill)
+                break;
 
-                source->position += 2;
-                source->remaining -= 2;
-            }
-            else if (source->repeat)
+            if (source->repeat && source->samples_in_total > 0)
             {
                 source->position = 0;
                 source->remaining = source->samples_in_total;
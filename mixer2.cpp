@@ -290,6 +290,19 @@ r32 source_s16_to_r32(s16 x)
     return result;
 }
 
+// Mixes _frames_ stereo frames from input into the mixing buffer.
+// The caller splits the source into runs, so there is no state
+// to check per frame.
+void source_mix(r32 *output, s16 *input, s32 frames,
+                r32 gain_l, r32 gain_r)
+{
+    for (s32 i = 0; i < frames; i++)
+    {
+        output[2*i+0] += gain_l * source_s16_to_r32(input[2*i+0]);
+        output[2*i+1] += gain_r * source_s16_to_r32(input[2*i+1]);
+    }
+}
+
 #define AUDIO_MAX_PLAYING 16
 struct Audio
 {
@@ -390,28 +403,28 @@ void audio_callback(void *userdata, u08 *stream, s32 bytes_to_fill)
         r32 gain_l = source->gain_l;
         r32 gain_r = source->gain_r;
 
-        for (int sample_index = 0;
-             sample_index < samples_to_fill;
-             sample_index += 2)
+        // Mix the source in runs that end either at the end of
+        // the output buffer or at the end of the source.
+        int frames_to_fill = samples_to_fill / Source_Channels;
+        int frame_index = 0;
+        while (frame_index < frames_to_fill)
         {
-            if (source->remaining > 0)
-            {
-                s16 xs16_l, xs16_r;
-                r32 xr32_l, xr32_r;
+            int frames = source->remaining / Source_Channels;
+            if (frames > frames_to_fill - frame_index)
+                frames = frames_to_fill - frame_index;
 
-                xs16_l = source->buffer[source->position];
-                xs16_r = source->buffer[source->position+1];
+            source_mix(mix_buffer + frame_index*Source_Channels,
+                       source->buffer + source->position,
+                       frames, gain_l, gain_r);
 
-                xr32_l = source_s16_to_r32(xs16_l);
-                xr32_r = source_s16_to_r32(xs16_r);
+            frame_index += frames;
+            source->position += frames*Source_Channels;
+            source->remaining -= frames*Source_Channels;
 
-                mix_buffer[sample_index] += gain_l * xr32_l;
-                mix_buffer[sample_index+1] += gain_r * xr32_r;
+            if (frame_index == frames_to_fill)
+                break;
 
-                source->position += 2;
-                source->remaining -= 2;
-            }
-            else if (source->repeat)
+            if (source->repeat && source->samples_in_total > 0)
             {
                 source->position = 0;
                 source->remaining = source->samples_in_total;